@@ -1,26 +1,348 @@
 #include "huffmanCompress.h"
+#include "suffixArray.h"
+#include <chrono>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <iterator>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HUFFMAN_AVX2
+#include <immintrin.h>
+#endif
+
+// ownership and sparse files need the POSIX calls, elsewhere archives only keep modes and mtimes
+#if defined(__unix__) || defined(__APPLE__)
+#define HUFFMAN_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mappedFile::mappedFile(const std::string &path) : data(nullptr), size(0)
+{
+#ifdef HUFFMAN_POSIX
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open compressed file for reading.");
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            // entries are mostly read front to back, pages behind the decoder can be dropped early
+            ::madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+            data = (const char *)mapping;
+            size = st.st_size;
+        }
+    }
+    ::close(fd);
+    if (data)
+        return;
+#endif
+
+    // empty files and files that can't be mapped (pipes, other systems) are read
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error("Failed to open compressed file for reading.");
+    }
+    std::ostringstream buffer;
+    buffer << input.rdbuf();
+    contents = buffer.str();
+    data = contents.data();
+    size = contents.size();
+}
+
+mappedFile::~mappedFile()
+{
+#ifdef HUFFMAN_POSIX
+    if (contents.empty() && size > 0)
+        ::munmap((void *)data, size);
+#endif
+}
+
+#ifdef HUFFMAN_POSIX
+// output buffer over a file descriptor, for files opened with flags std::ofstream can't pass
+class fdOutputBuffer : public std::streambuf
+{
+private:
+    int fd;
+    std::vector<char> buffer;
+
+    bool flushBuffer()
+    {
+        const char *data = pbase();
+        size_t size = pptr() - pbase();
+        while (size > 0)
+        {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0)
+                return false;
+            data += written;
+            size -= written;
+        }
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return true;
+    }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!flushBuffer())
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override { return flushBuffer() ? 0 : -1; }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override
+    {
+        if (!flushBuffer())
+            return pos_type(off_type(-1));
+        int whence = dir == std::ios_base::beg ? SEEK_SET : dir == std::ios_base::cur ? SEEK_CUR : SEEK_END;
+        return pos_type(off_type(::lseek(fd, off, whence)));
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+
+public:
+    explicit fdOutputBuffer(int fd) : fd(fd), buffer(1 << 16)
+    {
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+    ~fdOutputBuffer() override
+    {
+        flushBuffer();
+        ::close(fd);
+    }
+};
+#endif
+
+outputFile::outputFile(const std::string &path) : path(path), stream(nullptr)
+{
+#ifdef HUFFMAN_POSIX
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0)
+    {
+        if (S_ISLNK(st.st_mode))
+        {
+            throw std::runtime_error("Refusing to write through the symlink " + path);
+        }
+        if (S_ISREG(st.st_mode) && ::unlink(path.c_str()) != 0)
+        {
+            throw std::runtime_error("Failed to replace " + path);
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0666);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open output file " + path);
+    }
+    buffer = std::make_unique<fdOutputBuffer>(fd);
+#else
+    if (std::filesystem::is_symlink(std::filesystem::symlink_status(path)))
+    {
+        throw std::runtime_error("Refusing to write through the symlink " + path);
+    }
+
+    auto file = std::make_unique<std::filebuf>();
+    if (!file->open(path, std::ios::out | std::ios::binary | std::ios::trunc))
+    {
+        throw std::runtime_error("Failed to open output file " + path);
+    }
+    buffer = std::move(file);
+#endif
+    stream.rdbuf(buffer.get());
+}
+
+void outputFile::close()
+{
+    if (!buffer)
+        return;
 
-void huffmanCompress::buildTree(const std::string &text, std::map<char, std::string> &charWithCode)
+    bool written = stream.flush() && buffer->pubsync() == 0;
+    stream.rdbuf(nullptr);
+    buffer.reset();
+    if (!written)
+    {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+outputFile::~outputFile()
+{
+    if (!buffer)
+        return;
+
+    stream.rdbuf(nullptr);
+    buffer.reset();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+}
+
+// 64 bit FNV-1a of data, continuing from hash
+static uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// gets what was written to the file onto the disk, so a crash can't leave later writes without it
+static void syncFile(const std::string &path)
+{
+#ifdef HUFFMAN_POSIX
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || ::fsync(fd) != 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        throw std::runtime_error("Failed to sync " + path);
+    }
+    ::close(fd);
+#else
+    (void)path;
+#endif
+}
+
+// Symlinks are only recreated when they point into the output folder: relative, with '..' only at the
+// start and not above the folder. A '..' after a name could climb out through another link.
+// archives store modification times as seconds and nanoseconds since the Unix epoch,
+// file_time_type has an unspecified epoch and resolution
+static void toUnixTime(std::filesystem::file_time_type time, int64_t &seconds, uint32_t &nanoseconds)
+{
+    auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        (time - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now()).time_since_epoch());
+    auto whole = std::chrono::floor<std::chrono::seconds>(since);
+    seconds = whole.count();
+    nanoseconds = (uint32_t)(since - whole).count();
+}
+
+#ifndef HUFFMAN_POSIX
+static std::filesystem::file_time_type fromUnixTime(int64_t seconds, uint32_t nanoseconds)
+{
+    std::chrono::system_clock::time_point time(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+        std::chrono::seconds(seconds) + std::chrono::nanoseconds(nanoseconds)));
+    return std::chrono::time_point_cast<std::filesystem::file_time_type::duration>(
+        time - std::chrono::system_clock::now() + std::filesystem::file_time_type::clock::now());
+}
+#endif
+
+static bool safeLinkTarget(const std::string &path, const std::string &target)
+{
+    std::filesystem::path link(target);
+    if (target.empty() || link.is_absolute() || link.has_root_name() || link.has_root_directory())
+        return false;
+
+    std::filesystem::path parent = std::filesystem::path(path).lexically_normal().parent_path();
+    long depth = std::distance(parent.begin(), parent.end());
+    bool descending = false;
+    for (const auto &part : link)
+    {
+        if (part == "..")
+        {
+            if (descending || --depth < 0)
+                return false;
+        }
+        else if (part != "." && !part.empty())
+        {
+            descending = true;
+        }
+    }
+    return true;
+}
+
+// Output that compares what is written with the contents of a file instead of storing it.
+// Seeks move the position in the file, so sparse extraction can be checked the same way.
+class compareBuffer : public std::streambuf
 {
-    // set the freqs
-    std::vector<int> freq(256, 0);
-    for (char c : text)
+private:
+    std::ifstream &file;
+    std::vector<char> buffer;
+    bool same = true;
+
+protected:
+    std::streamsize xsputn(const char *data, std::streamsize size) override
+    {
+        std::streamsize done = 0;
+        while (same && done < size)
+        {
+            std::streamsize chunk = std::min<std::streamsize>(size - done, buffer.size());
+            same = file.read(buffer.data(), chunk) && std::equal(buffer.data(), buffer.data() + chunk, data + done);
+            done += chunk;
+        }
+        return size;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            char byte = traits_type::to_char_type(c);
+            xsputn(&byte, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override
+    {
+        file.seekg(off, dir);
+        return file.tellg();
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
     {
-        freq[c]++;
+        return seekoff(off_type(pos), std::ios_base::beg, which);
     }
 
+public:
+    explicit compareBuffer(std::ifstream &file) : file(file), buffer(1 << 16) {}
+
+    bool matches() { return same && file; }
+};
+
+void huffmanCompress::buildTree(const std::vector<uint64_t> &freq, std::map<char, std::string> &charWithCode)
+{
+    freeTree(root);
+    root = nullptr;
+
     // initial nodes
+    std::vector<Node *> leaves;
     for (int i = 0; i < freq.size(); i++)
     {
         if (freq[i] != 0)
         {
-            pq.insert(new Node((char)i, freq[i]));
+            leaves.push_back(new Node((char)i, freq[i]));
         }
     }
-    // the above could be done in a different function "create pq"
+    minHeap<Node *, CompareNode> huffmanTree(leaves.begin(), leaves.end());
 
     // make the huff tree
-    minHeap<Node *, CompareNode> huffmanTree(pq);
     while (huffmanTree.size() != 1)
     {
         Node *left = huffmanTree.extractMin();
@@ -34,13 +356,103 @@ void huffmanCompress::buildTree(const std::string &text, std::map<char, std::str
             right = temp;
         }
 
-        int sum_freq = left->freq + right->freq;
+        uint64_t sum_freq = left->freq + right->freq;
         huffmanTree.insert(new Node(' ', sum_freq, left, right));
     }
 
     // generate the codes from the root of the huffman tree
     root = huffmanTree.extractMin();
     generateCodes(root, "", charWithCode);
+
+    for (const auto &pair : charWithCode)
+    {
+        if (pair.second.size() > MAX_CODE_SIZE)
+        {
+            limitCodeLengths(freq, charWithCode);
+            break;
+        }
+    }
+
+    // check if there is just one type of char in the data
+    if (charWithCode.size() == 1)
+    {
+        auto &entry = *charWithCode.begin();
+        if (entry.second.empty())
+        {
+            entry.second = "0"; // Fix empty code
+        }
+    }
+}
+
+// Skewed histograms give codes far longer than the table decoders take. Package-merge finds the
+// optimal code lengths of at most MAX_CODE_SIZE bits, canonical codes are then assigned in order
+// of length. Only runs when the tree is too deep, which costs little ratio.
+void huffmanCompress::limitCodeLengths(const std::vector<uint64_t> &freq, std::map<char, std::string> &charWithCode)
+{
+    std::vector<std::pair<uint64_t, int>> symbols;
+    for (int i = 0; i < (int)freq.size(); i++)
+    {
+        if (freq[i] != 0)
+            symbols.push_back({freq[i], i});
+    }
+    std::sort(symbols.begin(), symbols.end());
+    size_t n = symbols.size();
+
+    // an item is a leaf or a package of two cheaper items, with how often it holds each symbol
+    struct Item
+    {
+        uint64_t weight;
+        std::vector<uint8_t> count;
+    };
+    std::vector<Item> leaves;
+    for (size_t i = 0; i < n; i++)
+    {
+        Item leaf = {symbols[i].first, std::vector<uint8_t>(n, 0)};
+        leaf.count[i] = 1;
+        leaves.push_back(leaf);
+    }
+
+    std::vector<Item> items = leaves;
+    for (int level = 1; level < MAX_CODE_SIZE; level++)
+    {
+        std::vector<Item> packages;
+        for (size_t i = 0; i + 1 < items.size(); i += 2)
+        {
+            Item package = {items[i].weight + items[i + 1].weight, items[i].count};
+            for (size_t j = 0; j < n; j++)
+                package.count[j] += items[i + 1].count[j];
+            packages.push_back(package);
+        }
+
+        std::vector<Item> merged;
+        std::merge(leaves.begin(), leaves.end(), packages.begin(), packages.end(), std::back_inserter(merged),
+                   [](const Item &a, const Item &b)
+                   { return a.weight < b.weight; });
+        items = std::move(merged);
+    }
+
+    // a symbol's code length is the number of the 2n - 2 cheapest items it appears in
+    std::vector<int> length(n, 0);
+    for (size_t i = 0; i < 2 * n - 2; i++)
+    {
+        for (size_t j = 0; j < n; j++)
+            length[j] += items[i].count[j];
+    }
+
+    std::vector<std::pair<int, int>> order; // (length, symbol)
+    for (size_t i = 0; i < n; i++)
+        order.push_back({length[i], symbols[i].second});
+    std::sort(order.begin(), order.end());
+
+    charWithCode.clear();
+    uint32_t code = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        int size = order[i].first;
+        charWithCode[(char)order[i].second] = std::bitset<MAX_CODE_SIZE>(code).to_string().substr(MAX_CODE_SIZE - size);
+        if (i + 1 < n)
+            code = (code + 1) << (order[i + 1].first - size);
+    }
 }
 
 void huffmanCompress::generateCodes(Node *node, const std::string &code, std::map<char, std::string> &charWithCode)
@@ -77,595 +489,2675 @@ void printCodes(std::map<std::string, char> &CodeWithChar)
     }
 }
 
-void huffmanCompress::compressFile(const std::string &inputFilePath)
+std::vector<uint64_t> huffmanCompress::countFrequencies(std::istream &input, uint64_t size)
 {
+    std::vector<uint64_t> freq(256, 0);
+    std::vector<char> buffer(IO_BUFFER_SIZE);
 
-    std::ifstream input(inputFilePath, std::ios::binary);
-    if (!input.is_open())
+    uint64_t remaining = size;
+    while (remaining > 0)
     {
-        throw std::runtime_error("Failed to open input file!");
+        size_t chunk = std::min<uint64_t>(remaining, buffer.size());
+        if (!input.read(buffer.data(), chunk))
+        {
+            throw std::runtime_error("Failed to read input data!");
+        }
+        remaining -= chunk;
+
+        for (size_t i = 0; i < chunk; i++)
+            freq[(unsigned char)buffer[i]]++;
     }
-    std::ofstream output(inputFilePath + ".huff", std::ios::binary);
-    if (!output.is_open())
+
+    return freq;
+}
+
+// reads every sampleStride-th block only, so the tree is ready without a full pass
+// over the data. Symbols missing from the sample still get a (long) code.
+std::vector<uint64_t> huffmanCompress::sampleFrequencies(std::istream &input, uint64_t size)
+{
+    std::vector<uint64_t> freq(256, 0);
+    std::vector<char> buffer(SAMPLE_BLOCK_SIZE);
+
+    std::streampos start = input.tellg();
+    uint64_t step = (uint64_t)SAMPLE_BLOCK_SIZE * sampleStride;
+    for (uint64_t offset = 0; offset < size; offset += step)
     {
-        throw std::runtime_error("Failed to open output file!");
+        size_t chunk = std::min<uint64_t>(size - offset, buffer.size());
+        input.seekg(start + (std::streamoff)offset);
+        if (!input.read(buffer.data(), chunk))
+        {
+            throw std::runtime_error("Failed to read input data!");
+        }
+
+        for (size_t i = 0; i < chunk; i++)
+            freq[(unsigned char)buffer[i]]++;
     }
 
-    // basic reading from file
-    std::string data;
-    char c;
-    while (input.get(c))
+    // scale the sample up to the whole input and give the unseen symbols the minimum frequency
+    for (uint64_t &f : freq)
+        f = f == 0 ? 1 : f * sampleStride;
+
+    return freq;
+}
+
+// size of the stream the exact histogram would have produced, for reporting the sampling loss
+uint64_t huffmanCompress::exactStreamSize(const std::vector<uint64_t> &freq)
+{
+    std::map<char, std::string> charWithCode;
+    buildTree(freq, charWithCode);
+
+    uint64_t table = 0;
+    uint64_t bits = 0;
+    for (auto &pair : charWithCode)
     {
-        data += c;
+        table += 2 + pair.second.size();
+        bits += freq[(unsigned char)pair.first] * pair.second.size();
     }
 
-    input.close();
+    // flags, original size, unique count, table, payload size and payload
+    return 1 + 8 + 1 + table + 8 + (bits + 7) / 8;
+}
 
-    if (data.empty())
+EncodeTable huffmanCompress::makeEncodeTable(const std::map<char, std::string> &charWithCode)
+{
+    EncodeTable table = {};
+    for (auto &pair : charWithCode)
     {
-        std::ofstream output(inputFilePath + ".huff", std::ios::binary);
-        if (!output.is_open())
-        {
-            throw std::runtime_error("Failed to open output file!");
-        }
+        unsigned char ch = pair.first;
+        uint64_t code = 0;
+        for (char bit : pair.second)
+            code = (code << 1) | (bit == '1');
 
-        std::string emptyMarker(1, 0); // num_unique = 0
-        emptyMarker += (char)0;        // padding = 0
-        output.write(emptyMarker.c_str(), emptyMarker.size());
-        output.close();
-        return;
+        table.code[ch] = code;
+        table.length[ch] = pair.second.size();
+        if (pair.second.size() <= MAX_VECTOR_CODE_SIZE)
+            table.packed[ch] = (uint32_t)code | (uint32_t)pair.second.size() << 16;
+
+        table.max_length = std::max<int>(table.max_length, pair.second.size());
     }
+    return table;
+}
 
-    // map for the chars with their respective codes
-    std::map<char, std::string> charWithCode;
+static inline void storeBigEndian64(unsigned char *out, uint64_t value)
+{
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap64(value);
+    std::memcpy(out, &value, 8);
+#else
+    for (int i = 0; i < 8; i++)
+        out[i] = (unsigned char)(value >> (56 - i * 8));
+#endif
+}
+
+// appends a code of at most 56 bits, at most 7 bits may be pending
+static inline void putBits(BitWriter &writer, uint64_t code, int length)
+{
+    writer.acc |= code << (64 - writer.count - length);
+    writer.count += length;
+}
 
-    // build a huffman tree with the data in the file
-    buildTree(data, charWithCode);
+// stores the pending whole bytes, 8 bytes are always written
+static inline void flushWriter(BitWriter &writer)
+{
+    storeBigEndian64(writer.out, writer.acc);
+    writer.out += writer.count >> 3;
+    writer.acc <<= writer.count & ~7;
+    writer.count &= 7;
+}
 
-    // check if there is just one type of char in the file
-    if (charWithCode.size() == 1)
+static bool cpuHasAVX2()
+{
+#ifdef HUFFMAN_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+static void encodeScalar(const EncodeTable &table, const unsigned char *in, size_t n, BitWriter &writer)
+{
+    // a local copy stays in registers, the output pointer could alias the member
+    BitWriter w = writer;
+    size_t i = 0;
+
+    // two codes fit the 56 free bits between flushes
+    if (table.max_length <= 28)
     {
-        auto &entry = *charWithCode.begin();
-        if (entry.second.empty())
+        for (; i + 2 <= n; i += 2)
         {
-            entry.second = "0"; // Fix empty code
+            putBits(w, table.code[in[i]], table.length[in[i]]);
+            putBits(w, table.code[in[i + 1]], table.length[in[i + 1]]);
+            flushWriter(w);
         }
     }
 
-    std::string encoded_data;
-    for (char c : data)
-        encoded_data += charWithCode[c];
+    for (; i < n; i++)
+    {
+        putBits(w, table.code[in[i]], table.length[in[i]]);
+        flushWriter(w);
+    }
+    writer = w;
+}
+
+#ifdef HUFFMAN_AVX2
+// Looks up 8 codes with one gather and merges them in registers: adjacent codes into
+// pairs of at most 28 bits, pairs into two words of at most 56 bits that are written
+// with one store each.
+__attribute__((target("avx2"))) static void encodeAVX2(const EncodeTable &table, const unsigned char *in, size_t n, BitWriter &writer)
+{
+    const __m256i codeMask = _mm256_set1_epi32(0xFFFF);
+    const __m256i lowMask = _mm256_set1_epi64x(0xFFFFFFFF);
 
-    // attaching the metadata
-    std::string in = "", s = "";
+    BitWriter w = writer;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + i)));
+        __m256i entry = _mm256_i32gather_epi32((const int *)table.packed, index, 4);
+        __m256i code = _mm256_and_si256(entry, codeMask);
+        __m256i length = _mm256_srli_epi32(entry, 16);
+
+        // even symbol followed by the odd one, in the low half of every 64 bit lane
+        __m256i oddCode = _mm256_srli_epi64(code, 32);
+        __m256i oddLength = _mm256_srli_epi64(length, 32);
+        __m256i pairCode = _mm256_and_si256(_mm256_or_si256(_mm256_sllv_epi32(code, oddLength), oddCode), lowMask);
+        __m256i pairLength = _mm256_and_si256(_mm256_add_epi32(length, oddLength), lowMask);
+
+        // pairs 0,1 and 2,3 of every 128 bit lane into lanes 0 and 2
+        __m256i nextCode = _mm256_srli_si256(pairCode, 8);
+        __m256i nextLength = _mm256_srli_si256(pairLength, 8);
+        __m256i quadCode = _mm256_or_si256(_mm256_sllv_epi64(pairCode, nextLength), nextCode);
+        __m256i quadLength = _mm256_add_epi64(pairLength, nextLength);
+
+        putBits(w, _mm256_extract_epi64(quadCode, 0), (int)_mm256_extract_epi64(quadLength, 0));
+        flushWriter(w);
+        putBits(w, _mm256_extract_epi64(quadCode, 2), (int)_mm256_extract_epi64(quadLength, 2));
+        flushWriter(w);
+    }
+
+    writer = w;
+    encodeScalar(table, in + i, n - i, writer);
+}
+#endif
+
+// picks the encoder kernel from the longest code, the same one for every chunk of a stream
+void huffmanCompress::encodeChunk(const EncodeTable &table, const unsigned char *in, size_t n, BitWriter &writer, bool vector)
+{
+#ifdef HUFFMAN_AVX2
+    if (vector && table.max_length <= MAX_VECTOR_CODE_SIZE && cpuHasAVX2())
+        return encodeAVX2(table, in, n, writer);
+#endif
+    encodeScalar(table, in, n, writer);
+}
+
+// Pre-pass stages, applied in this order before the Huffman coder and undone in reverse.
+// encode transforms the data and appends its side parts, decode gets them back in the same order.
+const huffmanCompress::Stage huffmanCompress::STAGES[] = {
+    {FLAG_BWT, "bwt + mtf", 1, &huffmanCompress::bwtEncode, &huffmanCompress::bwtDecode},
+    {FLAG_RLE, "rle", 1, &huffmanCompress::rleEncode, &huffmanCompress::rleDecode},
+};
+
+// Streams with stages enabled (any STAGE_FLAGS bit):
+//   flags (1) | original size (8) | block size (4) | blocks
+// Every block of at most block size input bytes goes through the stages on its own and is stored as
+//   part count (1) | parts, each a Huffman stream
+// The first part is the transformed data, the side parts of the stages follow in stage order.
+void huffmanCompress::encodeStream(std::istream &input, uint64_t size, std::ostream &output)
+{
+    if (stages == 0 || size == 0)
+    {
+        encodeHuffman(input, size, output);
+        return;
+    }
 
-    in += (char)pq.size();
-    while (!pq.empty())
+    std::string header;
+    header += stages;
+    appendUint64(header, size);
+    appendUint32(header, STAGE_BLOCK_SIZE);
+    output.write(header.c_str(), header.size());
+
+    for (uint64_t remaining = size; remaining > 0;)
     {
-        Node *current = pq.extractMin();
-        char ch = current->ch;
-        in += ch;
+        size_t chunk = std::min<uint64_t>(remaining, STAGE_BLOCK_SIZE);
+        remaining -= chunk;
 
-        int code_size = charWithCode[current->ch].size();
-        in += (char)code_size;
+        std::vector<std::string> parts(1);
+        std::string data = readBytes(input, chunk);
+        for (const Stage &stage : STAGES)
+        {
+            if (stages & stage.flag)
+                data = (this->*stage.encode)(data, parts);
+        }
+        parts[0] = std::move(data);
 
-        s = charWithCode[current->ch];
-        in += s;
+        char count = (char)parts.size();
+        output.write(&count, 1);
+        for (const std::string &part : parts)
+        {
+            std::istringstream partInput(part);
+            encodeHuffman(partInput, part.size(), output);
+        }
     }
+}
 
-    // padding the encoded data to be a multiple of 8
-    int padding = (8 - encoded_data.size() % 8) % 8;
-    in += (char)padding;
-    std::string padded_encoded = std::string(padding, '0');
-    padded_encoded += encoded_data;
-    encoded_data = padded_encoded;
-    while (!encoded_data.empty())
+size_t huffmanCompress::decodeStream(std::string_view compressedData, std::ostream &output, size_t pos)
+{
+    char flags = compressedData.at(pos);
+    if (!(flags & STAGE_FLAGS))
+        return decodeHuffman(compressedData, output, pos);
+
+    uint64_t original_size = readUint64(compressedData, pos + 1);
+    uint32_t blockSize = readUint32(compressedData, pos + 9);
+    pos += 13;
+    if (blockSize == 0 || blockSize > MAX_STAGE_BLOCK_SIZE)
     {
-        in += (char)binary_to_decimal(encoded_data.substr(0, 8));
-        encoded_data = encoded_data.substr(8);
+        throw std::runtime_error("Invalid stage block size!");
     }
 
-    output.write(in.c_str(), in.size());
-    output.close();
+    for (uint64_t remaining = original_size; remaining > 0;)
+    {
+        uint64_t chunk = std::min<uint64_t>(remaining, blockSize);
+        pos = decodeStageBlock(compressedData, output, pos, flags, chunk);
+        remaining -= chunk;
+    }
 
-    std::cout << "Compressed: " + inputFilePath << std::endl;
-    std::cout << "Size before compression: " << data.size() << " bytes" << std::endl;
-    std::cout << "Size after compression: " << in.size() << " bytes" << std::endl
-              << std::endl;
+    return pos;
 }
 
-void huffmanCompress::decompressFile(const std::string &inputFilePath)
+// one block of a staged stream, only the block is held in memory
+size_t huffmanCompress::decodeStageBlock(std::string_view compressedData, std::ostream &output, size_t pos, char flags, uint64_t original_size)
 {
+    size_t count = (unsigned char)compressedData.at(pos);
+    pos++;
 
-    std::ifstream input(inputFilePath, std::ios::binary);
-    if (!input.is_open())
+    std::vector<std::string> parts;
+    for (size_t i = 0; i < count; i++)
     {
-        throw std::runtime_error("Failed to open input file!");
+        // no stage output is much larger than its block, a corrupt size must not run away with memory
+        if (readUint64(compressedData, pos + 1) > 2 * original_size + 64)
+        {
+            throw std::runtime_error("Invalid stage parts in compressed data!");
+        }
+
+        std::ostringstream part;
+        pos = decodeHuffman(compressedData, part, pos);
+        parts.push_back(part.str());
     }
 
-    std::string outputFilePath = "huff_" + inputFilePath.substr(0, inputFilePath.size() - 5);
+    // where the side parts of every stage start
+    std::vector<size_t> sides;
+    size_t next = 1;
+    for (const Stage &stage : STAGES)
+    {
+        sides.push_back(next);
+        if (flags & stage.flag)
+            next += stage.sideParts;
+    }
+    if (count == 0 || next != count)
+    {
+        throw std::runtime_error("Invalid stage parts in compressed data!");
+    }
 
-    std::ofstream output(outputFilePath, std::ios::binary);
-    if (!output.is_open())
+    std::string data = std::move(parts[0]);
+    for (size_t i = std::size(STAGES); i-- > 0;)
     {
-        throw std::runtime_error("Failed to open output file!");
+        // through a reference, as in encodeStream. GCC 12 with -fsanitize=address,undefined miscompiles
+        // the indexed member pointer call and reads a clobbered index.
+        const Stage &stage = STAGES[i];
+        if (flags & stage.flag)
+            data = (this->*stage.decode)(data, &parts[sides[i]], original_size);
+    }
+
+    if (data.size() != original_size)
+    {
+        throw std::runtime_error("Size mismatch after the pre-pass stages!");
     }
+    output.write(data.c_str(), data.size());
+
+    return pos;
+}
+
+// runs job(0) ... job(count - 1) on up to one thread per core, the first exception is rethrown
+template <typename Job>
+static size_t parallelFor(size_t count, Job job)
+{
+    size_t threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorLock;
+
+    auto worker = [&]
+    {
+        try
+        {
+            for (size_t i; (i = next++) < count;)
+                job(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorLock);
+            if (!error)
+                error = std::current_exception();
+            next = count;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+        thread.join();
+
+    if (error)
+        std::rethrow_exception(error);
+    return threads;
+}
+
+// BWT of the block followed by a sentinel that sorts first. The sentinel is left out of the
+// output and the row it was in is returned.
+static uint32_t bwtBlock(const unsigned char *in, unsigned char *out, size_t n)
+{
+    suffixArrayInts sa = suffixArray(in, n);
+
+    // row 0 is the sentinel on its own, preceded by the last byte
+    out[0] = in[n - 1];
+    size_t o = 1;
+    uint32_t primary = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (sa[i] == 0)
+            primary = i + 1;
+        else
+            out[o++] = in[sa[i] - 1];
+    }
+    return primary;
+}
+
+static void unbwtBlock(const unsigned char *in, unsigned char *out, size_t n, uint32_t primary)
+{
+    if (primary == 0 || primary > n)
+    {
+        throw std::runtime_error("Invalid BWT primary index!");
+    }
+
+    // the last column has n + 1 rows with the sentinel at primary
+    auto last = [&](size_t row)
+    { return in[row < primary ? row : row - 1]; };
+
+    uint32_t next[256] = {};
+    for (size_t i = 0; i < n; i++)
+        next[in[i]]++;
+    uint32_t sum = 1; // the sentinel is the first row of the sorted column
+    for (int c = 0; c < 256; c++)
+    {
+        uint32_t count = next[c];
+        next[c] = sum;
+        sum += count;
+    }
+
+    std::vector<uint32_t> lf(n + 1);
+    for (size_t row = 0; row <= n; row++)
+        lf[row] = row == primary ? 0 : next[last(row)]++;
+
+    size_t row = 0;
+    for (size_t k = n; k-- > 0;)
+    {
+        if (row == primary)
+        {
+            throw std::runtime_error("Invalid BWT data!");
+        }
+        out[k] = last(row);
+        row = lf[row];
+    }
+}
+
+static void moveToFront(unsigned char *data, size_t n)
+{
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++)
+        order[i] = i;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char c = data[i];
+        unsigned char j = 0;
+        while (order[j] != c)
+            j++;
+        memmove(order + 1, order, j);
+        order[0] = c;
+        data[i] = j;
+    }
+}
+
+static void undoMoveToFront(unsigned char *data, size_t n)
+{
+    unsigned char order[256];
+    for (int i = 0; i < 256; i++)
+        order[i] = i;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char j = data[i];
+        unsigned char c = order[j];
+        memmove(order + 1, order, j);
+        order[0] = c;
+        data[i] = c;
+    }
+}
+
+// Every BWT_BLOCK_SIZE block is suffix sorted on its own, the blocks in parallel. MTF turns the
+// clustered BWT output into mostly small values. Side part: block size (4) | primary index (4) per block.
+std::string huffmanCompress::bwtEncode(const std::string &data, std::vector<std::string> &side)
+{
+    size_t blocks = (data.size() + BWT_BLOCK_SIZE - 1) / BWT_BLOCK_SIZE;
+    std::string transformed(data.size(), 0);
+    std::vector<uint32_t> primary(blocks);
+    std::vector<size_t> memory(blocks);
+
+    const unsigned char *in = (const unsigned char *)data.data();
+    unsigned char *out = (unsigned char *)&transformed[0];
+    size_t threads = parallelFor(blocks, [&](size_t b)
+                                 {
+        size_t start = b * BWT_BLOCK_SIZE;
+        size_t n = std::min<size_t>(BWT_BLOCK_SIZE, data.size() - start);
+
+        suffixArrayMemory::reset();
+        size_t base = suffixArrayMemory::current;
+        primary[b] = bwtBlock(in + start, out + start, n);
+        moveToFront(out + start, n);
+        memory[b] = suffixArrayMemory::peak - base; });
+
+    blockMemory = std::max(blockMemory, *std::max_element(memory.begin(), memory.end()));
+    blockThreads = std::max(blockThreads, threads);
+
+    std::string indexes;
+    appendUint32(indexes, BWT_BLOCK_SIZE);
+    for (uint32_t p : primary)
+        appendUint32(indexes, p);
+    side.push_back(indexes);
+
+    return transformed;
+}
+
+std::string huffmanCompress::bwtDecode(const std::string &data, const std::string *side, uint64_t maxSize)
+{
+    const std::string &indexes = side[0];
+    if (data.size() > maxSize || indexes.size() < 4)
+    {
+        throw std::runtime_error("Invalid BWT data!");
+    }
+
+    uint32_t blockSize = readUint32(indexes, 0);
+    if (blockSize == 0 || (indexes.size() - 4) / 4 != (data.size() + blockSize - 1) / blockSize)
+    {
+        throw std::runtime_error("Invalid BWT data!");
+    }
+
+    std::string restored(data.size(), 0);
+    std::string transformed = data;
+    unsigned char *in = (unsigned char *)&transformed[0];
+    unsigned char *out = (unsigned char *)&restored[0];
+    parallelFor((indexes.size() - 4) / 4, [&](size_t b)
+                {
+        size_t start = b * blockSize;
+        size_t n = std::min<size_t>(blockSize, data.size() - start);
+
+        undoMoveToFront(in + start, n);
+        unbwtBlock(in + start, out + start, n, readUint32(indexes, 4 + 4 * b)); });
+
+    return restored;
+}
+
+// prints the suffix sorting memory of the blocks compressed since the last report
+void huffmanCompress::reportBlockMemory()
+{
+    if (blockMemory == 0)
+        return;
+
+    std::ostringstream mib;
+    mib << std::fixed << std::setprecision(1) << blockMemory / (1024.0 * 1024.0);
+    std::cout << "Block sorting memory: " << mib.str() << " MiB per " << BWT_BLOCK_SIZE / 1024 << " KiB block, "
+              << blockThreads << " blocks in parallel" << std::endl;
+    blockMemory = 0;
+    blockThreads = 0;
+}
+
+// Runs of RUN_THRESHOLD or more equal bytes are cut to RUN_THRESHOLD copies, the number of
+// further copies goes to the side part as a base 128 varint, so long runs cost a few symbols.
+std::string huffmanCompress::rleEncode(const std::string &data, std::vector<std::string> &side)
+{
+    std::string literals(data.size(), 0);
+    std::string runs;
+    size_t out = 0;
+
+    size_t i = 0;
+    while (i < data.size())
+    {
+        char byte = data[i];
+        size_t end = i + 1;
+        while (end < data.size() && data[end] == byte)
+            end++;
+
+        size_t length = std::min<size_t>(end - i, RUN_THRESHOLD);
+        memset(&literals[out], byte, length);
+        out += length;
+
+        if (length == RUN_THRESHOLD)
+        {
+            uint64_t extra = end - i - RUN_THRESHOLD;
+            while (extra >= 0x80)
+            {
+                runs += (char)((extra & 0x7F) | 0x80);
+                extra >>= 7;
+            }
+            runs += (char)extra;
+        }
+        i = end;
+    }
+
+    literals.resize(out);
+    side.push_back(runs);
+    return literals;
+}
+
+std::string huffmanCompress::rleDecode(const std::string &data, const std::string *side, uint64_t maxSize)
+{
+    const std::string &runs = side[0];
+    if (data.size() > maxSize)
+    {
+        throw std::runtime_error("Invalid run length data!");
+    }
+
+    // grown on demand up to maxSize, corrupt run lengths can't allocate ahead of the data
+    std::string decoded(std::min<uint64_t>(maxSize, 2 * data.size() + 64), 0);
+    char *out = &decoded[0];
+    uint64_t produced = 0;
+    auto reserve = [&](uint64_t needed)
+    {
+        if (produced + needed > decoded.size())
+        {
+            decoded.resize(std::min<uint64_t>(maxSize, std::max<uint64_t>(produced + needed, 2 * decoded.size())));
+            out = &decoded[0];
+        }
+    };
+
+    size_t r = 0;
+    size_t repeat = 0;
+    char last = 0;
+    for (char byte : data)
+    {
+        repeat = (repeat > 0 && byte == last) ? repeat + 1 : 1;
+        last = byte;
+        if (produced == maxSize)
+        {
+            throw std::runtime_error("Invalid run length data!");
+        }
+        reserve(1);
+        out[produced++] = byte;
+
+        if (repeat == RUN_THRESHOLD)
+        {
+            uint64_t extra = 0;
+            int shift = 0;
+            char c;
+            do
+            {
+                if (r >= runs.size() || shift > 63)
+                {
+                    throw std::runtime_error("Invalid run length data!");
+                }
+                c = runs[r++];
+                extra |= (uint64_t)(c & 0x7F) << shift;
+                shift += 7;
+            } while (c & 0x80);
+
+            if (extra > maxSize - produced)
+            {
+                throw std::runtime_error("Invalid run length data!");
+            }
+            reserve(extra);
+            memset(out + produced, byte, extra);
+            produced += extra;
+            repeat = 0;
+        }
+    }
+
+    decoded.resize(produced);
+    return decoded;
+}
+
+// Huffman stream layout:
+//   flags (1) | original size (8)
+//   num_unique - 1 (1) | num_unique * [char (1) | code size (1) | code as '0'/'1']
+//   payload size (8) | exact stream size (8, sampled streams only)
+//   payload, zero padded at the end to a multiple of 8 bits
+// Empty inputs end right after the original size. The input is read from its current position.
+void huffmanCompress::encodeHuffman(std::istream &input, uint64_t size, std::ostream &output)
+{
+    bool sampled = sampleStride > 1 && size >= samplingThreshold(sampleStride);
+    char flags = sampled ? FLAG_SAMPLED : 0;
+
+    std::string header;
+    header += flags;
+    appendUint64(header, size);
+
+    if (size == 0)
+    {
+        output.write(header.c_str(), header.size());
+        return;
+    }
+
+    std::streampos start = input.tellg();
+    std::vector<uint64_t> freq = (flags & FLAG_SAMPLED) ? sampleFrequencies(input, size) : countFrequencies(input, size);
+    input.clear();
+    input.seekg(start);
+
+    // map for the chars with their respective codes
+    std::map<char, std::string> charWithCode;
+    buildTree(freq, charWithCode);
+
+    // attaching the metadata
+    header += (char)(charWithCode.size() - 1);
+    for (auto &pair : charWithCode)
+    {
+        header += pair.first;
+        header += (char)pair.second.size();
+        header += pair.second;
+    }
+
+    // the sizes are only known once the data is encoded, patched below
+    std::streampos sizesPos = output.tellp() + (std::streamoff)header.size();
+    appendUint64(header, 0);
+    if (flags & FLAG_SAMPLED)
+        appendUint64(header, 0);
+
+    output.write(header.c_str(), header.size());
+
+    // encode the data in a single pass, counting the exact histogram on the way
+    EncodeTable table = makeEncodeTable(charWithCode);
+
+    std::vector<uint64_t> exactFreq(256, 0);
+    std::vector<char> buffer(IO_BUFFER_SIZE);
+    // worst case output of a chunk plus the slack of the 8 byte stores
+    std::vector<unsigned char> packed(IO_BUFFER_SIZE * table.max_length / 8 + 16);
+    BitWriter writer;
+    uint64_t payload_size = 0;
+
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+        size_t chunk = std::min<uint64_t>(remaining, buffer.size());
+        if (!input.read(buffer.data(), chunk))
+        {
+            throw std::runtime_error("Failed to read input data!");
+        }
+        remaining -= chunk;
+
+        if (flags & FLAG_SAMPLED)
+        {
+            for (size_t i = 0; i < chunk; i++)
+                exactFreq[(unsigned char)buffer[i]]++;
+        }
+
+        writer.out = packed.data();
+        encodeChunk(table, (const unsigned char *)buffer.data(), chunk, writer);
+
+        output.write((const char *)packed.data(), writer.out - packed.data());
+        payload_size += writer.out - packed.data();
+    }
+
+    // the last partial byte of the bit writer, zero padded
+    if (writer.count > 0)
+    {
+        char last = (char)(writer.acc >> 56);
+        output.write(&last, 1);
+        payload_size++;
+    }
+
+    std::string sizes;
+    appendUint64(sizes, payload_size);
+    if (flags & FLAG_SAMPLED)
+        appendUint64(sizes, exactStreamSize(exactFreq));
+
+    std::streampos end = output.tellp();
+    output.seekp(sizesPos);
+    output.write(sizes.c_str(), sizes.size());
+    output.seekp(end);
+}
+
+// Every length and count read from the stream is checked against the data, so truncated or
+// malicious input throws instead of reading out of bounds.
+size_t huffmanCompress::decodeHuffman(std::string_view compressedData, std::ostream &output, size_t pos)
+{
+    char flags = compressedData.at(pos);
+    pos++;
+
+    uint64_t original_size = readUint64(compressedData, pos);
+    pos += 8;
+
+    if (original_size == 0)
+        return pos;
+
+    int num_unique = (unsigned char)compressedData.at(pos) + 1;
+    pos++;
+
+    // reading the codes from the metadata
+    std::vector<std::pair<std::string, char>> codes;
+    int max_code_size = 0;
+    for (int i = 0; i < num_unique; i++)
+    {
+        if (compressedData.size() - pos < 2)
+        {
+            throw std::runtime_error("Compressed data is truncated!");
+        }
+        char ch = compressedData[pos];
+        pos++;
+
+        unsigned char ch_code_size = compressedData[pos];
+        pos++;
+
+        if (ch_code_size == 0 || compressedData.size() - pos < ch_code_size)
+        {
+            throw std::runtime_error("Corrupted code table!");
+        }
+        std::string ch_code(compressedData.substr(pos, ch_code_size));
+        pos += ch_code_size;
+
+        if (ch_code.find_first_not_of("01") != std::string::npos)
+        {
+            throw std::runtime_error("Corrupted code table!");
+        }
+
+        codes.push_back({ch_code, ch});
+        max_code_size = std::max<int>(max_code_size, ch_code_size);
+    }
+
+    uint64_t payload_size = readUint64(compressedData, pos);
+    pos += 8;
+
+    if (flags & FLAG_SAMPLED)
+        pos += 8;
+
+    if (pos > compressedData.size() || payload_size > compressedData.size() - pos)
+    {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+
+    const unsigned char *payload = (const unsigned char *)compressedData.data() + pos;
+    pos += payload_size;
+
+    decodePayload(codes, payload, payload_size, output, original_size, max_code_size);
+    return pos;
+}
+
+// the kernel is chosen once per stream from its longest code, it stops after count symbols
+void huffmanCompress::decodePayload(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count, int maxLength)
+{
+    if (maxLength <= 11)
+        decodeKernel<11>(codes, in, inSize, output, count);
+    else if (maxLength <= 12)
+        decodeKernel<12>(codes, in, inSize, output, count);
+    else if (maxLength <= 14)
+        decodeKernel<14>(codes, in, inSize, output, count);
+    else
+        decodeGeneric(codes, in, inSize, output, count);
+}
+
+// the payload is read most significant bit first
+static inline uint64_t loadBigEndian64(const unsigned char *in)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | in[i];
+    return value;
+}
+
+// Table driven decoder for codes of at most MAX_LEN bits. Every refill leaves at least
+// 56 bits in the buffer, so 56 / MAX_LEN symbols are decoded per refill without checks.
+// The symbols go through a buffer of IO_BUFFER_SIZE bytes, whatever the size of the stream.
+template <int MAX_LEN>
+void huffmanCompress::decodeKernel(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count)
+{
+    constexpr int SYMBOLS_PER_REFILL = 56 / MAX_LEN;
+
+    // every MAX_LEN bit pattern starting with a code maps to that code
+    std::vector<DecodeEntry> table(1 << MAX_LEN, DecodeEntry{0, 0});
+    for (const auto &code : codes)
+    {
+        uint32_t value = binary_to_decimal(code.first);
+        int shift = MAX_LEN - (int)code.first.size();
+        for (uint32_t i = value << shift; i < (value + 1) << shift; i++)
+            table[i] = DecodeEntry{(unsigned char)code.second, (unsigned char)code.first.size()};
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(count, IO_BUFFER_SIZE));
+    char *out = buffer.data();
+
+    uint64_t bitbuf = 0; // the next bits of the payload, left aligned
+    int bitcount = 0;
+    size_t ip = 0;
+    uint64_t produced = 0;
+    unsigned char invalid = 0;
+
+    while (produced < count)
+    {
+        size_t chunk = std::min<uint64_t>(count - produced, buffer.size());
+        size_t filled = 0;
+
+        // branchless refill while a whole word can be loaded
+        while (ip + 8 <= inSize && chunk - filled >= SYMBOLS_PER_REFILL)
+        {
+            bitbuf |= loadBigEndian64(in + ip) >> bitcount;
+            ip += (63 - bitcount) >> 3;
+            bitcount |= 56;
+
+            for (int k = 0; k < SYMBOLS_PER_REFILL; k++)
+            {
+                DecodeEntry entry = table[bitbuf >> (64 - MAX_LEN)];
+                out[filled + k] = entry.symbol;
+                invalid |= entry.length == 0;
+                bitbuf <<= entry.length;
+                bitcount -= entry.length;
+            }
+            filled += SYMBOLS_PER_REFILL;
+        }
+
+        // the last few symbols of the chunk, reading zeros past the end of the payload.
+        // Stops below 56 bits so the refill above never shifts by 64.
+        while (filled < chunk)
+        {
+            while (bitcount < 56)
+            {
+                uint64_t byte = ip < inSize ? in[ip] : 0;
+                bitbuf |= byte << (56 - bitcount);
+                ip++;
+                bitcount += 8;
+            }
+
+            DecodeEntry entry = table[bitbuf >> (64 - MAX_LEN)];
+            out[filled++] = entry.symbol;
+            invalid |= entry.length == 0;
+            bitbuf <<= entry.length;
+            bitcount -= entry.length;
+        }
+
+        if (invalid || (uint64_t)ip * 8 - bitcount > (uint64_t)inSize * 8)
+        {
+            throw std::runtime_error("Corrupted compressed data!");
+        }
+
+        output.write(out, chunk);
+        produced += chunk;
+    }
+}
+
+// bit by bit tree walk for streams with codes longer than 14 bits, which the encoder doesn't produce
+void huffmanCompress::decodeGeneric(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count)
+{
+    // children of every node, 0 is no child and leaves are stored as ~symbol
+    std::vector<std::array<int, 2>> tree(1, {0, 0});
+    for (const auto &code : codes)
+    {
+        int node = 0;
+        for (size_t i = 0; i < code.first.size(); i++)
+        {
+            int bit = code.first[i] == '1';
+            if (i + 1 == code.first.size())
+            {
+                tree[node][bit] = ~(int)(unsigned char)code.second;
+                break;
+            }
+            if (tree[node][bit] == 0)
+            {
+                tree[node][bit] = tree.size();
+                tree.push_back({0, 0});
+            }
+            node = tree[node][bit];
+            if (node < 0)
+            {
+                throw std::runtime_error("Corrupted code table!");
+            }
+        }
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(count, IO_BUFFER_SIZE));
+    size_t filled = 0;
+
+    uint64_t bit = 0;
+    uint64_t total = (uint64_t)inSize * 8;
+    for (uint64_t produced = 0; produced < count; produced++)
+    {
+        if (filled == buffer.size())
+        {
+            output.write(buffer.data(), filled);
+            filled = 0;
+        }
+
+        int node = 0;
+        do
+        {
+            if (bit == total)
+            {
+                throw std::runtime_error("Corrupted compressed data!");
+            }
+            node = tree[node][(in[bit >> 3] >> (7 - (bit & 7))) & 1];
+            bit++;
+        } while (node > 0);
+
+        if (node == 0)
+        {
+            throw std::runtime_error("Corrupted compressed data!");
+        }
+        buffer[filled++] = (char)~node;
+    }
+    output.write(buffer.data(), filled);
+}
+
+// Compressed file layout: FILE_MAGIC | FORMAT_VERSION (1) | one stream
+void huffmanCompress::compressFile(const std::string &inputFilePath)
+{
+
+    std::ifstream input(inputFilePath, std::ios::binary);
+    if (!input.is_open())
+    {
+        throw std::runtime_error("Failed to open input file!");
+    }
+    std::ofstream output(inputFilePath + ".huff", std::ios::binary);
+    if (!output.is_open())
+    {
+        throw std::runtime_error("Failed to open output file!");
+    }
+
+    uint64_t size = std::filesystem::file_size(inputFilePath);
+    std::string header = formatHeader(FILE_MAGIC);
+    output.write(header.c_str(), header.size());
+    encodeStream(input, size, output);
+
+    uint64_t newSize = output.tellp();
+    output.close();
+    input.close();
+
+    std::cout << "Compressed: " + inputFilePath << std::endl;
+    std::cout << "Size before compression: " << size << " bytes" << std::endl;
+    if (sampleStride > 1 && size < samplingThreshold(sampleStride))
+        std::cout << "Below the sampling threshold of " << samplingThreshold(sampleStride) << " bytes, exact histogram used" << std::endl;
+    reportBlockMemory();
+    std::cout << "Size after compression: " << newSize << " bytes" << std::endl
+              << std::endl;
+}
+
+void huffmanCompress::decompressFile(const std::string &inputFilePath)
+{
+    mappedFile archive(inputFilePath);
+    std::string_view compressed_data = archive.view();
+
+    std::string outputFilePath = "huff_" + inputFilePath.substr(0, inputFilePath.size() - 5);
+
+    // before the output is created, files of another format don't leave an empty one behind
+    checkFormat(compressed_data, FILE_MAGIC, inputFilePath);
+    decompressFileUtil(compressed_data, outputFilePath, FORMAT_HEADER_SIZE);
+}
+
+// sparse files are compressed one stream per data extent, the holes are not stored
+std::string huffmanCompress::compressFileUtil(const std::string &inputFilePath, const std::vector<std::pair<uint64_t, uint64_t>> &extents)
+{
+    std::ifstream input(inputFilePath, std::ios::binary);
+    if (!input.is_open())
+    {
+        throw std::runtime_error("Failed to open input file!");
+    }
+
+    std::ostringstream output;
+    if (extents.empty())
+    {
+        encodeStream(input, std::filesystem::file_size(inputFilePath), output);
+    }
+    for (const auto &extent : extents)
+    {
+        input.seekg(extent.first);
+        encodeStream(input, extent.second, output);
+    }
+    input.close();
+
+    std::cout << "Compressed: " << inputFilePath << std::endl;
+
+    return output.str();
+}
+// the inputFilePath is the string with all the compressed code in it
+size_t huffmanCompress::decompressFileUtil(std::string_view compressedData, const std::string &outputFilePath, size_t pos = 0)
+{
+
+    outputFile output(outputFilePath);
+    pos = decodeStream(compressedData, output.stream, pos);
+    output.close();
+
+    std::cout << "Decompressed: " << outputFilePath << std::endl;
+
+    return pos;
+}
+
+void huffmanCompress::freeTree(Node *node)
+{
+    if (!node)
+        return;
+    if (node->left)
+        freeTree(node->left);
+    if (node->right)
+        freeTree(node->right);
+    delete node;
+}
+
+int huffmanCompress::binary_to_decimal(const std::string &in)
+{
+    int result = 0;
+    for (int i = 0; i < in.size(); i++)
+        result = result * 2 + in[i] - '0';
+    return result;
+}
+
+void huffmanCompress::appendUint32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out += (char)(value >> (i * 8));
+    }
+}
+
+uint32_t huffmanCompress::readUint32(std::string_view in, size_t pos)
+{
+    if (pos > in.size() || in.size() - pos < 4)
+    {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        value |= (static_cast<uint32_t>(in[pos + i]) & 0xFF) << (i * 8);
+    }
+    return value;
+}
+
+void huffmanCompress::appendUint64(std::string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out += (char)(value >> (i * 8));
+    }
+}
+
+uint64_t huffmanCompress::readUint64(std::string_view in, size_t pos)
+{
+    if (pos > in.size() || in.size() - pos < 8)
+    {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        value |= (static_cast<uint64_t>(in[pos + i]) & 0xFF) << (i * 8);
+    }
+    return value;
+}
+
+// grows with the data actually read, a corrupt size can't allocate more than the input holds
+std::string huffmanCompress::readBytes(std::istream &input, size_t size)
+{
+    std::string data;
+    while (data.size() < size)
+    {
+        size_t offset = data.size();
+        size_t chunk = std::min<size_t>(size - offset, IO_BUFFER_SIZE << 4);
+        data.resize(offset + chunk);
+        if (!input.read(&data[offset], chunk))
+        {
+            throw std::runtime_error("Compressed data is truncated!");
+        }
+    }
+    return data;
+}
+
+std::string huffmanCompress::readFile(const std::string &path)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error("Failed to open compressed file for reading.");
+    }
+
+    std::ostringstream data;
+    data << input.rdbuf();
+    return data.str();
+}
+
+std::string huffmanCompress::formatHeader(const char *magic)
+{
+    return std::string(magic, 4) + FORMAT_VERSION;
+}
+
+bool huffmanCompress::hasFormat(std::string_view data, const char *magic)
+{
+    return data.size() >= FORMAT_HEADER_SIZE && data.compare(0, 4, magic) == 0;
+}
+
+// throws unless data starts with magic and the format version this build reads
+void huffmanCompress::checkFormat(std::string_view data, const char *magic, const std::string &path)
+{
+    if (!hasFormat(data, magic))
+    {
+        throw std::runtime_error(path + " has no format header. Files made by releases before format version 2 "
+                                 "can't be read, decompress them with the release that made them.");
+    }
+    if (data[4] != FORMAT_VERSION)
+    {
+        throw std::runtime_error(path + " is format version " + std::to_string((int)data[4]) +
+                                 ", this build reads version " + std::to_string((int)FORMAT_VERSION));
+    }
+}
+
+// smallest input sampled at the given stride, smaller ones are counted exactly
+uint64_t huffmanCompress::samplingThreshold(int stride)
+{
+    return MIN_SAMPLED_BLOCKS * SAMPLE_BLOCK_SIZE * stride;
+}
+
+void huffmanCompress::setSampling(int percent)
+{
+    // a stride of 1 would read every block, that is just the exact histogram
+    sampleStride = (percent <= 0 || percent > 50) ? 0 : 100 / percent;
+}
+
+void huffmanCompress::setRunLength(bool enabled)
+{
+    stages = enabled ? (stages | FLAG_RLE) : (stages & ~FLAG_RLE);
+}
+
+void huffmanCompress::setBlockSorting(bool enabled)
+{
+    stages = enabled ? (stages | FLAG_BWT) : (stages & ~FLAG_BWT);
+}
+
+void huffmanCompress::compressFolder(const std::string &inputFolder)
+{
+    std::string header = formatHeader(ARCHIVE_MAGIC);
+    std::vector<ArchiveEntry> entries;
+
+    // (size, hash) of every stored payload -> the entry it was stored for
+    std::map<std::pair<uint64_t, uint64_t>, ArchiveEntry> payloads;
+
+    uint64_t size = 0;
+    size_t duplicate_files = 0;
+    size_t sparse_files = 0;
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(inputFolder))
+    {
+        // lexically, relative() would resolve symlinks to their targets
+        std::string relative_path = entry.path().lexically_relative(inputFolder).string();
+        ArchiveEntry current = makeEntry(entry, relative_path);
+
+        if (current.type == '>')
+        {
+            current.extents = dataExtents(entry.path().string(), current.size);
+            current.hash = hashFile(entry.path().string(), current.extents);
+            if (!current.extents.empty())
+                sparse_files++;
+
+            // identical files only reference the payload stored first
+            auto payload = payloads.find({current.size, current.hash});
+            if (payload != payloads.end() && sameContents(header, payload->second, entry.path().string(), current.extents))
+            {
+                current.offset = payload->second.offset;
+                duplicate_files++;
+            }
+            else
+            {
+                std::string compressed_data = compressFileUtil(entry.path().string(), current.extents);
+
+                header += ">" + relative_path + "|";
+                current.offset = header.size();
+                header += compressed_data;
+
+                payloads.insert({{current.size, current.hash}, current});
+            }
+
+            entries.push_back(current);
+            size += current.size;
+        }
+        else if (current.type != 0)
+        {
+            entries.push_back(current);
+        }
+    }
+
+    header += serializeDirectory(entries, header.size());
+
+    std::ofstream outFile(inputFolder + ".huff", std::ios::binary);
+    outFile.write(header.c_str(), header.size());
+    outFile.close();
+
+    uint64_t newSize = std::filesystem::file_size(inputFolder + ".huff");
+
+    std::cout << "Compression complete! " << std::endl;
+    std::cout << "Duplicate files: " << duplicate_files << std::endl;
+    std::cout << "Sparse files: " << sparse_files << std::endl;
+    std::cout << "Size before compression: " << size << " bytes" << std::endl;
+    reportBlockMemory();
+    std::cout << "Size after compression: " << newSize << " bytes" << std::endl
+              << std::endl;
+}
+
+void huffmanCompress::decompressFolder(const std::string &inputFolder)
+{
+    std::string folderName = "huff_" + inputFolder.substr(0, inputFolder.size() - 5);
+
+    // sequential archives are extracted while they are read, without seeking
+    std::ifstream input(inputFolder, std::ios::binary);
+    if (!input)
+    {
+        throw std::runtime_error("Failed to open compressed file for reading.");
+    }
+    std::string magic(FORMAT_HEADER_SIZE, 0);
+    input.read(&magic[0], magic.size());
+    magic.resize(input.gcount());
+    if (hasFormat(magic, SEQUENTIAL_MAGIC))
+    {
+        checkFormat(magic, SEQUENTIAL_MAGIC, inputFolder);
+        decompressFolderSequential(input, folderName);
+        return;
+    }
+    input.close();
+
+    uint64_t directoryOffset, archiveEnd;
+    std::vector<ArchiveEntry> entries = readDirectory(inputFolder, directoryOffset, archiveEnd);
+    mappedFile archive(inputFolder);
+    std::string_view compressed_data = archive.view();
+
+    std::filesystem::create_directories(folderName);
+
+    auto outputPath = [&](const ArchiveEntry &entry)
+    {
+        return extractPath(folderName, entry.path);
+    };
+
+    // every output of a stream, duplicates are decoded once and copied
+    std::map<uint64_t, std::vector<const ArchiveEntry *>> outputs;
+    for (const ArchiveEntry &entry : entries)
+    {
+        if (entry.type == '>')
+            outputs[entry.offset].push_back(&entry);
+    }
+
+    // directories get their metadata last, extracting into them changes their mtime
+    std::vector<const ArchiveEntry *> directories;
+
+    for (const ArchiveEntry &entry : entries)
+    {
+        std::string fullpath = outputPath(entry);
+
+        // dictionary
+        if (entry.type == '<')
+        {
+            if (std::filesystem::is_symlink(std::filesystem::symlink_status(fullpath)))
+            {
+                throw std::runtime_error("Refusing to extract into the symlink " + fullpath);
+            }
+            std::filesystem::create_directories(fullpath);
+            directories.push_back(&entry);
+        }
+        if (entry.type == '@')
+        {
+            if (!safeLinkTarget(entry.path, entry.target))
+            {
+                std::cout << "Skipped: " << fullpath << " -> " << entry.target << " (points outside the folder)" << std::endl;
+                continue;
+            }
+
+            std::filesystem::create_directories(std::filesystem::path(fullpath).parent_path());
+            std::filesystem::remove(fullpath);
+            std::filesystem::create_symlink(entry.target, fullpath);
+            restoreOwner(fullpath, entry.uid, entry.gid);
+
+            std::cout << "Linked: " << fullpath << " -> " << entry.target << std::endl;
+        }
+        if (entry.type == '>')
+        {
+            auto copies = outputs.find(entry.offset);
+            if (copies == outputs.end())
+                continue; // already written as a duplicate
+
+            if (!entry.extents.empty())
+            {
+                // copying would fill the holes
+                for (const ArchiveEntry *copy : copies->second)
+                    extractFile(compressed_data, *copy, outputPath(*copy));
+            }
+            else
+            {
+                std::string first = outputPath(entry);
+                extractFile(compressed_data, entry, first);
+
+                for (const ArchiveEntry *copy : copies->second)
+                {
+                    std::string path = outputPath(*copy);
+                    if (path == first)
+                        continue;
+
+                    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+                    std::ifstream source(first, std::ios::binary);
+                    outputFile output(path);
+                    if (source.peek() != std::ifstream::traits_type::eof())
+                        output.stream << source.rdbuf();
+                    output.close();
+
+                    std::cout << "Decompressed: " << path << std::endl;
+                }
+            }
+
+            // the owner first, chown clears the setuid and setgid bits. Legacy entries have no mode.
+            for (const ArchiveEntry *copy : copies->second)
+            {
+                restoreOwner(outputPath(*copy), copy->uid, copy->gid);
+                if (copy->mode != 0)
+                    restoreMetadata(outputPath(*copy), copy->mode, copy->mtime, copy->mtimeNsec);
+            }
+
+            outputs.erase(copies);
+        }
+    }
+
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+    {
+        restoreOwner(outputPath(**it), (*it)->uid, (*it)->gid);
+        if ((*it)->mode != 0)
+            restoreMetadata(outputPath(**it), (*it)->mode, (*it)->mtime, (*it)->mtimeNsec);
+    }
+
+    std::cout << "Decompression complete! " << std::endl
+              << std::endl;
+}
+
+// Compresses only the files whose size or mtime differ from the archive directory and
+// appends them together with a new directory. Changed files whose contents are already
+// stored reuse that stream. Modes, owners and symlinks are always taken from the folder.
+// Superseded streams and directories stay in the archive as dead space until compactFolder
+// is run. compareHashes also hashes the files that look unchanged.
+// The archive is only appended to, and the new trailer is written last: until it is complete
+// the previous trailer is the last valid one, which readTrailer falls back to. A failed update
+// is truncated back to the previous archive.
+void huffmanCompress::updateFolder(const std::string &inputFolder, bool compareHashes)
+{
+    std::string archivePath = inputFolder + ".huff";
+    if (!std::filesystem::exists(archivePath))
+    {
+        compressFolder(inputFolder);
+        return;
+    }
+
+    uint64_t directoryOffset, archiveEnd;
+    std::map<std::string, ArchiveEntry> previous;
+    std::map<std::pair<uint64_t, uint64_t>, ArchiveEntry> payloads;
+    for (const ArchiveEntry &entry : readDirectory(archivePath, directoryOffset, archiveEnd))
+    {
+        if (entry.type != '>')
+            continue;
+
+        previous[entry.path] = entry;
+        if (entry.hash != 0)
+            payloads[{entry.size, entry.hash}] = entry;
+    }
+
+    // the incomplete tail of an interrupted update
+    if (archiveEnd < std::filesystem::file_size(archivePath))
+        std::filesystem::resize_file(archivePath, archiveEnd);
+
+    std::fstream archive(archivePath, std::ios::in | std::ios::out | std::ios::binary);
+    if (!archive.is_open())
+    {
+        throw std::runtime_error("Failed to open " + archivePath + " for update.");
+    }
+    archive.seekp(0, std::ios::end);
+    uint64_t end = archiveEnd;
+
+    std::vector<ArchiveEntry> entries;
+    size_t unchanged_files = 0;
+    size_t reused_files = 0;
+    size_t compressed_files = 0;
+    uint64_t size = 0;
+
+    try
+    {
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(inputFolder))
+        {
+            std::string relative_path = entry.path().lexically_relative(inputFolder).string();
+            ArchiveEntry current = makeEntry(entry, relative_path);
+
+            if (current.type == '>')
+            {
+                auto old = previous.find(relative_path);
+                bool unchanged = old != previous.end() && old->second.size == current.size &&
+                                 old->second.mtime == current.mtime && old->second.mtimeNsec == current.mtimeNsec;
+
+                // catches changes that kept the size and mtime
+                if (unchanged && compareHashes)
+                {
+                    current.hash = hashFile(entry.path().string(), old->second.extents);
+                    unchanged = current.hash == old->second.hash;
+                }
+
+                if (unchanged)
+                {
+                    current.hash = old->second.hash;
+                    current.offset = old->second.offset;
+                    current.extents = old->second.extents;
+                    unchanged_files++;
+                    entries.push_back(current);
+                    continue;
+                }
+
+                current.extents = dataExtents(entry.path().string(), current.size);
+                current.hash = hashFile(entry.path().string(), current.extents);
+
+                // touched but identical files and copies of stored files keep the stored stream
+                auto payload = payloads.find({current.size, current.hash});
+                bool reused = false;
+                if (payload != payloads.end())
+                {
+                    archive.flush();
+                    mappedFile stored(archivePath);
+                    reused = sameContents(stored.view(), payload->second, entry.path().string(), current.extents);
+                }
+
+                if (reused)
+                {
+                    current.offset = payload->second.offset;
+                    reused_files++;
+                }
+                else
+                {
+                    std::string record = ">" + relative_path + "|";
+                    std::string compressed_data = compressFileUtil(entry.path().string(), current.extents);
+
+                    archive.write(record.c_str(), record.size());
+                    archive.write(compressed_data.c_str(), compressed_data.size());
+
+                    current.offset = end + record.size();
+                    payloads.insert({{current.size, current.hash}, current});
+
+                    end += record.size() + compressed_data.size();
+                    size += current.size;
+                    compressed_files++;
+                }
+
+                entries.push_back(current);
+            }
+            else if (current.type != 0)
+            {
+                entries.push_back(current);
+            }
+        }
+
+        // the streams are on disk before the directory that refers to them
+        archive.flush();
+        if (!archive)
+        {
+            throw std::runtime_error("Failed to write " + archivePath);
+        }
+        syncFile(archivePath);
+
+        std::string directory = serializeDirectory(entries, end);
+        archive.write(directory.c_str(), directory.size());
+        archive.close();
+        if (!archive)
+        {
+            throw std::runtime_error("Failed to write " + archivePath);
+        }
+        syncFile(archivePath);
+    }
+    catch (...)
+    {
+        archive.close();
+        std::error_code error;
+        std::filesystem::resize_file(archivePath, archiveEnd, error);
+        throw;
+    }
+
+    std::cout << "Update complete! " << std::endl;
+    std::cout << "Unchanged files: " << unchanged_files << std::endl;
+    std::cout << "Reused streams: " << reused_files << std::endl;
+    std::cout << "Compressed files: " << compressed_files << " (" << size << " bytes)" << std::endl;
+    reportBlockMemory();
+    std::cout << "Archive size: " << std::filesystem::file_size(archivePath) << " bytes" << std::endl
+              << std::endl;
+}
+
+// rewrites the archive with only the streams referenced by its directory, copied from the
+// mapped archive to the new one without holding either in memory
+void huffmanCompress::compactFolder(const std::string &archivePath)
+{
+    uint64_t directoryOffset, archiveEnd;
+    std::vector<ArchiveEntry> entries = readDirectory(archivePath, directoryOffset, archiveEnd);
+    mappedFile archive(archivePath);
+    std::string_view compressed_data = archive.view();
+
+    std::string tempPath = archivePath + ".tmp";
+    std::ofstream output(tempPath, std::ios::binary);
+    if (!output.is_open())
+    {
+        throw std::runtime_error("Failed to open output file " + tempPath);
+    }
+
+    std::string header = formatHeader(ARCHIVE_MAGIC);
+    output.write(header.c_str(), header.size());
+    uint64_t size = header.size();
+
+    std::map<uint64_t, uint64_t> moved; // old stream offset -> new one, shared by duplicates
+    for (ArchiveEntry &entry : entries)
+    {
+        if (entry.type != '>')
+            continue;
+
+        auto stream = moved.find(entry.offset);
+        if (stream != moved.end())
+        {
+            entry.offset = stream->second;
+            continue;
+        }
+
+        size_t end = skipEntry(compressed_data, entry);
+
+        std::string record = ">" + entry.path + "|";
+        output.write(record.c_str(), record.size());
+        output.write(compressed_data.data() + entry.offset, end - entry.offset);
+
+        uint64_t offset = size + record.size();
+        moved[entry.offset] = offset;
+        size = offset + end - entry.offset;
+        entry.offset = offset;
+    }
+
+    std::string directory = serializeDirectory(entries, size);
+    output.write(directory.c_str(), directory.size());
+    size += directory.size();
+    output.close();
+    if (!output)
+    {
+        throw std::runtime_error("Failed to write " + tempPath);
+    }
+
+    syncFile(tempPath);
+    std::filesystem::rename(tempPath, archivePath);
+
+    std::cout << "Compaction complete! " << std::endl;
+    std::cout << "Size before compaction: " << compressed_data.size() << " bytes" << std::endl;
+    std::cout << "Size after compaction: " << size << " bytes" << std::endl
+              << std::endl;
+}
+
+// Sequential archive layout, written front to back so it can go to a pipe or a tape:
+//   SEQUENTIAL_MAGIC | FORMAT_VERSION (1), then for every entry
+//   header size (4) | type (1) | mode (4) | mtime (8) | mtime ns (4) | size (8) | path
+//   symlinks: size is the length of the link target, which ends the header after the path
+//   files only: block size (4) | compressed stream of at most SEQUENTIAL_BLOCK_SIZE bytes, ..., 0 (4)
+// and a header size of 0 at the end.
+void huffmanCompress::compressFolderSequential(const std::string &inputFolder, const std::string &outputPath)
+{
+    std::ofstream output(outputPath, std::ios::binary);
+    if (!output.is_open())
+    {
+        throw std::runtime_error("Failed to open output file " + outputPath);
+    }
+    std::string magic = formatHeader(SEQUENTIAL_MAGIC);
+    output.write(magic.c_str(), magic.size());
+
+    std::vector<char> block(SEQUENTIAL_BLOCK_SIZE);
+    uint64_t size = 0;
+    uint64_t newSize = magic.size();
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(inputFolder))
+    {
+        // lexically, relative() would resolve symlinks to their targets
+        std::string relative_path = entry.path().lexically_relative(inputFolder).string();
+        ArchiveEntry current = makeEntry(entry, relative_path);
+        if (current.type == 0)
+            continue;
+
+        bool file = current.type == '>';
+        std::string header;
+        header += current.type;
+        appendUint32(header, current.mode);
+        appendUint64(header, current.mtime);
+        appendUint32(header, current.mtimeNsec);
+        appendUint64(header, file ? current.size : current.target.size());
+        header += relative_path + current.target;
+
+        std::string frame;
+        appendUint32(frame, header.size());
+        frame += header;
+        output.write(frame.c_str(), frame.size());
+        newSize += frame.size();
+
+        if (file)
+        {
+            std::ifstream input(entry.path(), std::ios::binary);
+            if (!input.is_open())
+            {
+                throw std::runtime_error("Failed to open input file!");
+            }
+
+            uint64_t remaining = current.size;
+            while (remaining > 0)
+            {
+                size_t chunk = std::min<uint64_t>(remaining, block.size());
+                if (!input.read(block.data(), chunk))
+                {
+                    throw std::runtime_error("Failed to read input data!");
+                }
+                remaining -= chunk;
+
+                std::istringstream blockInput(std::string(block.data(), chunk));
+                std::ostringstream compressed;
+                encodeStream(blockInput, chunk, compressed);
+
+                std::string data;
+                appendUint32(data, compressed.str().size());
+                data += compressed.str();
+                output.write(data.c_str(), data.size());
+                newSize += data.size();
+            }
+
+            std::string end;
+            appendUint32(end, 0);
+            output.write(end.c_str(), end.size());
+            newSize += end.size();
+
+            size += current.size;
+            std::cout << "Compressed: " << entry.path().string() << std::endl;
+        }
+
+        // hand the finished entry to a reader on the other end of a pipe
+        output.flush();
+    }
+
+    std::string end;
+    appendUint32(end, 0);
+    output.write(end.c_str(), end.size());
+    output.close();
+    newSize += end.size();
+
+    std::cout << "Compression complete! " << std::endl;
+    std::cout << "Size before compression: " << size << " bytes" << std::endl;
+    reportBlockMemory();
+    std::cout << "Size after compression: " << newSize << " bytes" << std::endl
+              << std::endl;
+}
+
+// reads the archive front to back, only one block is held in memory at a time
+void huffmanCompress::decompressFolderSequential(std::istream &input, const std::string &folderName)
+{
+    std::filesystem::create_directories(folderName);
+
+    // directories get their metadata last, extracting into them changes their mtime
+    std::vector<std::tuple<std::string, uint32_t, int64_t, uint32_t>> directories;
+
+    while (true)
+    {
+        uint32_t headerSize = readUint32(readBytes(input, 4), 0);
+        if (headerSize == 0)
+            break;
+        if (headerSize <= SEQUENTIAL_HEADER_SIZE)
+        {
+            throw std::runtime_error("Invalid sequential archive entry.");
+        }
+
+        std::string header = readBytes(input, headerSize);
+        char type = header[0];
+        uint32_t mode = readUint32(header, 1);
+        int64_t mtime = readUint64(header, 5);
+        uint32_t mtimeNsec = readUint32(header, 13);
+        uint64_t size = readUint64(header, 17);
+        if ((type == '@' && size > headerSize - SEQUENTIAL_HEADER_SIZE) || mtimeNsec >= 1000000000)
+        {
+            throw std::runtime_error("Invalid sequential archive entry.");
+        }
+        std::string path = header.substr(SEQUENTIAL_HEADER_SIZE, headerSize - SEQUENTIAL_HEADER_SIZE - (type == '@' ? size : 0));
+        std::string fullpath = extractPath(folderName, path);
+
+        if (type == '<')
+        {
+            if (std::filesystem::is_symlink(std::filesystem::symlink_status(fullpath)))
+            {
+                throw std::runtime_error("Refusing to extract into the symlink " + fullpath);
+            }
+            std::filesystem::create_directories(fullpath);
+            directories.push_back({fullpath, mode, mtime, mtimeNsec});
+        }
+        else if (type == '@')
+        {
+            std::string target = header.substr(headerSize - size);
+            if (!safeLinkTarget(path, target))
+            {
+                std::cout << "Skipped: " << fullpath << " -> " << target << " (points outside the folder)" << std::endl;
+                continue;
+            }
+
+            std::filesystem::create_directories(std::filesystem::path(fullpath).parent_path());
+            std::filesystem::remove(fullpath);
+            std::filesystem::create_symlink(target, fullpath);
+            std::cout << "Linked: " << fullpath << " -> " << target << std::endl;
+        }
+        else if (type == '>')
+        {
+            std::filesystem::create_directories(std::filesystem::path(fullpath).parent_path());
+            outputFile output(fullpath);
+
+            while (true)
+            {
+                uint32_t blockSize = readUint32(readBytes(input, 4), 0);
+                if (blockSize == 0)
+                    break;
+
+                // a block holds exactly one stream
+                std::string block = readBytes(input, blockSize);
+                if (decodeStream(block, output.stream, 0) != block.size())
+                {
+                    throw std::runtime_error("Invalid block in " + fullpath);
+                }
+            }
+
+            if ((uint64_t)output.stream.tellp() != size)
+            {
+                throw std::runtime_error("Size mismatch for " + fullpath);
+            }
+            output.close();
+
+            restoreMetadata(fullpath, mode, mtime, mtimeNsec);
+            std::cout << "Decompressed: " << fullpath << std::endl;
+        }
+        else
+        {
+            throw std::runtime_error("Invalid sequential archive entry.");
+        }
+    }
+
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+        restoreMetadata(std::get<0>(*it), std::get<1>(*it), std::get<2>(*it), std::get<3>(*it));
+
+    std::cout << "Decompression complete! " << std::endl
+              << std::endl;
+}
+
+void huffmanCompress::infoSequential(const std::string &compressedData)
+{
+    std::istringstream input(compressedData);
+    readBytes(input, FORMAT_HEADER_SIZE);
+
+    while (true)
+    {
+        uint32_t headerSize = readUint32(readBytes(input, 4), 0);
+        if (headerSize == 0)
+            break;
+        if (headerSize <= SEQUENTIAL_HEADER_SIZE)
+        {
+            throw std::runtime_error("Invalid sequential archive entry.");
+        }
+
+        std::string header = readBytes(input, headerSize);
+        uint64_t size = readUint64(header, 17);
+        std::string relativePath = header.substr(SEQUENTIAL_HEADER_SIZE);
+
+        if (header[0] == '<')
+        {
+            std::cout << "[Dir] " << relativePath << "\n";
+            continue;
+        }
+        if (header[0] == '@')
+        {
+            if (size > relativePath.size())
+            {
+                throw std::runtime_error("Invalid sequential archive entry.");
+            }
+            std::cout << "[Link] " << relativePath.substr(0, relativePath.size() - size) << " -> "
+                      << relativePath.substr(relativePath.size() - size) << "\n";
+            continue;
+        }
+
+        std::cout << "[File] " << relativePath << "\n";
+
+        uint64_t compressed = 4;
+        size_t blocks = 0;
+        while (true)
+        {
+            uint32_t blockSize = readUint32(readBytes(input, 4), 0);
+            if (blockSize == 0)
+                break;
+
+            input.seekg(blockSize, std::ios::cur);
+            compressed += 4 + blockSize;
+            blocks++;
+        }
+
+        std::cout << "  Original Size: " << size << " bytes\n";
+        std::cout << "  Compressed Size: " << compressed << " bytes in " << blocks << " blocks\n";
+    }
+}
+
+// Where an entry stored as path is extracted. Paths come from the archive and can't be trusted,
+// ones that are absolute, leave the output folder or lead through a symlink extracted earlier are rejected.
+std::string huffmanCompress::extractPath(const std::string &folderName, const std::string &path)
+{
+    std::filesystem::path relative = std::filesystem::path(path).lexically_normal();
+    if (relative.empty() || relative == "." || relative.is_absolute() || relative.has_root_name() ||
+        relative.has_root_directory() || *relative.begin() == "..")
+    {
+        throw std::runtime_error("Unsafe path in archive: " + path);
+    }
+
+    std::filesystem::path fullpath = folderName;
+    for (const auto &part : relative.parent_path())
+    {
+        fullpath /= part;
+        if (std::filesystem::is_symlink(std::filesystem::symlink_status(fullpath)))
+        {
+            throw std::runtime_error("Refusing to extract through the symlink " + fullpath.string());
+        }
+    }
+    return (fullpath / relative.filename()).string();
+}
+
+// never through a symlink, a later entry may have put one where a file or directory was extracted
+void huffmanCompress::restoreMetadata(const std::string &path, uint32_t mode, int64_t mtime, uint32_t mtimeNsec)
+{
+    if (std::filesystem::is_symlink(std::filesystem::symlink_status(path)))
+    {
+        throw std::runtime_error("Refusing to change metadata through the symlink " + path);
+    }
+
+    // nofollow fails on C libraries without fchmodat AT_SYMLINK_NOFOLLOW, the path was checked above
+    std::error_code error;
+    std::filesystem::permissions(path, (std::filesystem::perms)mode, std::filesystem::perm_options::replace | std::filesystem::perm_options::nofollow, error);
+    if (error)
+        std::filesystem::permissions(path, (std::filesystem::perms)mode);
+
+#ifdef HUFFMAN_POSIX
+    struct timespec times[2] = {};
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = mtime;
+    times[1].tv_nsec = mtimeNsec;
+    if (::utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        throw std::runtime_error("Failed to restore the modification time of " + path);
+    }
+#else
+    std::filesystem::last_write_time(path, fromUnixTime(mtime, mtimeNsec));
+#endif
+}
+
+// only root can give files away, everyone else keeps owning what they extract
+void huffmanCompress::restoreOwner(const std::string &path, uint32_t uid, uint32_t gid)
+{
+#ifdef HUFFMAN_POSIX
+    if (::geteuid() == 0 && ::lchown(path.c_str(), uid, gid) != 0)
+    {
+        throw std::runtime_error("Failed to restore the owner of " + path);
+    }
+#endif
+}
+
+// type and metadata of a folder entry without following symlinks. Type 0 marks entries
+// that are not archived (sockets, fifos, devices).
+ArchiveEntry huffmanCompress::makeEntry(const std::filesystem::directory_entry &entry, const std::string &relativePath)
+{
+    ArchiveEntry current;
+    current.path = relativePath;
+    std::filesystem::file_status status = entry.symlink_status();
+
+    if (std::filesystem::is_symlink(status))
+    {
+        current.type = '@';
+        current.target = std::filesystem::read_symlink(entry.path()).string();
+    }
+    else if (std::filesystem::is_regular_file(status))
+    {
+        current.type = '>';
+        current.size = entry.file_size();
+        toUnixTime(entry.last_write_time(), current.mtime, current.mtimeNsec);
+    }
+    else if (std::filesystem::is_directory(status))
+    {
+        current.type = '<';
+        toUnixTime(entry.last_write_time(), current.mtime, current.mtimeNsec);
+    }
+    else
+    {
+        return current;
+    }
+
+    current.mode = (uint32_t)status.permissions();
+#ifdef HUFFMAN_POSIX
+    struct stat st;
+    if (::lstat(entry.path().c_str(), &st) == 0)
+    {
+        current.uid = st.st_uid;
+        current.gid = st.st_gid;
+        // the exact time, file_time_type may be coarser or use another epoch
+#ifdef __APPLE__
+        struct timespec modified = st.st_mtimespec;
+#else
+        struct timespec modified = st.st_mtim;
+#endif
+        current.mtime = modified.tv_sec;
+        current.mtimeNsec = (uint32_t)modified.tv_nsec;
+    }
+#endif
+    return current;
+}
+
+// data regions of a sparse file. Empty for files without holes and where holes can't be found.
+std::vector<std::pair<uint64_t, uint64_t>> huffmanCompress::dataExtents(const std::string &path, uint64_t size)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> extents;
+#if defined(HUFFMAN_POSIX) && defined(SEEK_DATA)
+    if (size == 0)
+        return extents;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open input file!");
+    }
+
+    off_t data = 0;
+    while ((uint64_t)data < size)
+    {
+        data = ::lseek(fd, data, SEEK_DATA);
+        if (data < 0)
+        {
+            // ENXIO: only a hole is left, anything else: no hole detection on this file system
+            if (errno != ENXIO)
+                extents.clear();
+            else if (extents.empty())
+                extents.push_back({0, 0}); // all hole
+            break;
+        }
+
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        uint64_t end = hole < 0 ? size : std::min<uint64_t>(hole, size);
+        if ((uint64_t)data >= end)
+            break;
+
+        extents.push_back({data, end - data});
+        data = end;
+    }
+    ::close(fd);
+
+    // a single extent over the whole file is a dense file
+    if (extents.size() == 1 && extents[0].first == 0 && extents[0].second == size)
+        extents.clear();
+#endif
+    return extents;
+}
+
+// returns the position right after the streams of a file entry
+size_t huffmanCompress::skipEntry(std::string_view compressedData, const ArchiveEntry &entry)
+{
+    size_t pos = skipStream(compressedData, entry.offset);
+    for (size_t i = 1; i < entry.extents.size(); i++)
+        pos = skipStream(compressedData, pos);
+    return pos;
+}
+
+// writes one file entry, the holes of sparse files are seeked over and the size is set at the end
+void huffmanCompress::extractFile(std::string_view compressedData, const ArchiveEntry &entry, const std::string &path)
+{
+    if (entry.extents.empty())
+    {
+        decompressFileUtil(compressedData, path, entry.offset);
+        return;
+    }
+
+    outputFile output(path);
+    size_t pos = entry.offset;
+    for (const auto &extent : entry.extents)
+    {
+        output.stream.seekp(extent.first);
+        pos = decodeStream(compressedData, output.stream, pos);
+    }
+    output.close();
+
+    // a trailing hole
+    std::filesystem::resize_file(path, entry.size);
+
+    std::cout << "Decompressed: " << path << " (sparse, " << entry.extents.size() << " extents)" << std::endl;
+}
+
+// Directory layout: count (8) | count * [type (1) | path | '|' | size (8) | mtime (8) | mtime ns (4) | hash (8) |
+//   offset (8) | mode (4) | uid (4) | gid (4) | symlinks: target | '|' | files: extent count (8) | count * [offset (8) | length (8)]]
+// followed by the trailer: directory offset (8) | FNV-1a of the directory (8) | DIRECTORY_MAGIC
+std::string huffmanCompress::serializeDirectory(const std::vector<ArchiveEntry> &entries, uint64_t directoryOffset)
+{
+    std::string directory;
+    appendUint64(directory, entries.size());
+    for (const ArchiveEntry &entry : entries)
+    {
+        directory += entry.type;
+        directory += entry.path + "|";
+        appendUint64(directory, entry.size);
+        appendUint64(directory, entry.mtime);
+        appendUint32(directory, entry.mtimeNsec);
+        appendUint64(directory, entry.hash);
+        appendUint64(directory, entry.offset);
+        appendUint32(directory, entry.mode);
+        appendUint32(directory, entry.uid);
+        appendUint32(directory, entry.gid);
+
+        if (entry.type == '@')
+            directory += entry.target + "|";
+        if (entry.type == '>')
+        {
+            appendUint64(directory, entry.extents.size());
+            for (const auto &extent : entry.extents)
+            {
+                appendUint64(directory, extent.first);
+                appendUint64(directory, extent.second);
+            }
+        }
+    }
+
+    uint64_t hash = fnv1a(directory.data(), directory.size());
+    appendUint64(directory, directoryOffset);
+    appendUint64(directory, hash);
+    directory += DIRECTORY_MAGIC;
+    return directory;
+}
 
-    char num_unique;
-    input.get(num_unique);
-    // if the file is empty
-    if (num_unique == 0)
+// Finds the trailer closest to the end of the archive whose directory matches its hash. An
+// interrupted update leaves an incomplete tail after the last complete trailer, which is then
+// the one found. archiveEnd is where that trailer ends.
+bool huffmanCompress::readTrailer(std::string_view archive, uint64_t &directoryOffset, uint64_t &archiveEnd)
+{
+    std::string_view magic(DIRECTORY_MAGIC, 4);
+    size_t end = archive.size();
+    while (end >= FORMAT_HEADER_SIZE + TRAILER_SIZE)
     {
-        std::string outputFilePath = "huff_" + inputFilePath.substr(0, inputFilePath.size() - 5);
-        std::ofstream output(outputFilePath, std::ios::binary);
-        if (!output.is_open())
+        size_t found = archive.rfind(magic, end - magic.size());
+        if (found == std::string_view::npos || found + magic.size() < FORMAT_HEADER_SIZE + TRAILER_SIZE)
+            return false;
+
+        size_t trailer = found + magic.size() - TRAILER_SIZE;
+        uint64_t offset = readUint64(archive, trailer);
+        if (offset >= FORMAT_HEADER_SIZE && offset <= trailer &&
+            fnv1a(archive.data() + offset, trailer - offset) == readUint64(archive, trailer + 8))
         {
-            throw std::runtime_error("Failed to create empty output file!");
+            directoryOffset = offset;
+            archiveEnd = found + magic.size();
+            return true;
         }
-
-        output.close();
-        return;
+        end = found + magic.size() - 1;
     }
+    return false;
+}
 
-    // building a tree from the metadata
-    std::map<std::string, char> CodeWithChar;
-    for (size_t i = 0; i < num_unique; i++)
+// the directory of an archive held in memory
+std::vector<ArchiveEntry> huffmanCompress::archiveEntries(std::string_view compressedData, uint64_t &directoryOffset, uint64_t &archiveEnd)
+{
+    checkFormat(compressedData, ARCHIVE_MAGIC, "The archive");
+    if (!readTrailer(compressedData, directoryOffset, archiveEnd))
     {
-        char ch;
-        char ch_code_size;
-        std::string ch_code = "";
-
-        // input >> ch;
-        input.get(ch);
-        // std::cout << ch << std::endl;
-        input.get(ch_code_size);
-
-        for (size_t i = 0; i < ch_code_size; i++)
-        {
-            char bit;
-            input >> bit;
-            ch_code += bit;
-        }
-
-        CodeWithChar[ch_code] = ch;
+        throw std::runtime_error("The archive has no directory.");
     }
+    return parseDirectory(compressedData.substr(directoryOffset, archiveEnd - TRAILER_SIZE - directoryOffset));
+}
 
-    char padding;
-    input >> padding;
+// the directory of the archive file, the mapping only reads the pages of the header and the tail
+std::vector<ArchiveEntry> huffmanCompress::readDirectory(const std::string &archivePath, uint64_t &directoryOffset, uint64_t &archiveEnd)
+{
+    mappedFile archive(archivePath);
+    std::string_view compressed_data = archive.view();
 
-    std::string encoded_data;
-    char byte;
-    while (input.get(byte))
+    checkFormat(compressed_data, ARCHIVE_MAGIC, archivePath);
+    if (!readTrailer(compressed_data, directoryOffset, archiveEnd))
     {
-        encoded_data += std::bitset<8>(byte).to_string();
+        throw std::runtime_error(archivePath + " has no directory.");
     }
+    if (archiveEnd < compressed_data.size())
+    {
+        std::cout << "Ignoring " << compressed_data.size() - archiveEnd << " bytes after the last complete directory of "
+                  << archivePath << " (an interrupted update)" << std::endl;
+    }
+    return parseDirectory(compressed_data.substr(directoryOffset, archiveEnd - TRAILER_SIZE - directoryOffset));
+}
 
-    // std::cout << (int)padding << std::endl;
-    // std::cout << encoded_data << std::endl;
-
-    // remove the padding
-    encoded_data = encoded_data.substr(padding);
-
-    std::string data_decompressd = "";
+// the entries of a directory written by serializeDirectory
+std::vector<ArchiveEntry> huffmanCompress::parseDirectory(std::string_view directory)
+{
+    std::vector<ArchiveEntry> entries;
 
-    size_t i = 0;
-    while (i < encoded_data.size())
+    uint64_t count = readUint64(directory, 0);
+    size_t pos = 8;
+    for (uint64_t i = 0; i < count; i++)
     {
-        std::string code = "";
-        bool found = false;
+        ArchiveEntry entry;
+        entry.type = directory.at(pos);
+        pos++;
+
+        size_t pathEnd = directory.find('|', pos);
+        if (pathEnd == std::string::npos)
+        {
+            throw std::runtime_error("Invalid archive directory.");
+        }
+        entry.path = std::string(directory.substr(pos, pathEnd - pos));
+        pos = pathEnd + 1;
 
-        while (i < encoded_data.size())
+        entry.size = readUint64(directory, pos);
+        entry.mtime = readUint64(directory, pos + 8);
+        entry.mtimeNsec = readUint32(directory, pos + 16);
+        entry.hash = readUint64(directory, pos + 20);
+        entry.offset = readUint64(directory, pos + 28);
+        entry.mode = readUint32(directory, pos + 36);
+        entry.uid = readUint32(directory, pos + 40);
+        entry.gid = readUint32(directory, pos + 44);
+        pos += 48;
+        if (entry.mtimeNsec >= 1000000000)
         {
-            code += encoded_data[i];
-            i++;
+            throw std::runtime_error("Invalid archive directory.");
+        }
 
-            // check if the code exists in the map
-            if (CodeWithChar.find(code) != CodeWithChar.end())
+        if (entry.type == '@')
+        {
+            size_t targetEnd = directory.find('|', pos);
+            if (targetEnd == std::string::npos)
             {
-                data_decompressd += CodeWithChar[code];
-                found = true;
-                break;
+                throw std::runtime_error("Invalid archive directory.");
             }
+            entry.target = std::string(directory.substr(pos, targetEnd - pos));
+            pos = targetEnd + 1;
         }
-
-        if (!found)
+        if (entry.type == '>')
         {
-            if (binary_to_decimal(code) == 0)
-                break;
+            uint64_t extents = readUint64(directory, pos);
+            pos += 8;
+            if (extents > (directory.size() - pos) / 16)
+            {
+                throw std::runtime_error("Invalid archive directory.");
+            }
+            for (uint64_t j = 0; j < extents; j++)
+            {
+                entry.extents.push_back({readUint64(directory, pos), readUint64(directory, pos + 8)});
+                pos += 16;
+            }
         }
-    }
-
-    output.write(data_decompressd.c_str(), data_decompressd.size());
-
-    output.close();
-    input.close();
-
-    std::cout << "Decompressed: " << outputFilePath << std::endl;
 
-    // Validation
-    // if (data_decompressd.size() == data_decompressd.size()) // fix this
-    // {
-    //     std::cout << "Decoding successful!" << std::endl;
-    // }
-    // else
-    // {
-    //     std::runtime_error("Decoding failed");
-    // }
+        entries.push_back(entry);
+    }
+    return entries;
 }
 
-std::string huffmanCompress::compressFileUtil(const std::string &inputFilePath)
+// Whether the stream stored for entry decodes to the contents of the file at path, which has the
+// given extents. Equal sizes and hashes are only a hint, identical files are confirmed byte by byte.
+bool huffmanCompress::sameContents(std::string_view compressedData, const ArchiveEntry &stored, const std::string &path,
+                                   const std::vector<std::pair<uint64_t, uint64_t>> &extents)
 {
-    std::ifstream input(inputFilePath, std::ios::binary);
+    if (stored.extents != extents)
+        return false;
+
+    std::ifstream input(path, std::ios::binary);
     if (!input.is_open())
     {
         throw std::runtime_error("Failed to open input file!");
     }
 
-    // basic reading from file
-    std::string data;
-    char c;
-    while (input.get(c))
+    compareBuffer compare(input);
+    std::ostream output(&compare);
+    size_t pos = stored.offset;
+    if (extents.empty())
     {
-        data += c;
+        decodeStream(compressedData, output, pos);
+        return compare.matches() && input.peek() == std::ifstream::traits_type::eof();
     }
 
-    if (data.empty())
+    for (const auto &extent : extents)
     {
-        std::string output;
-        output += (char)0;
-        return output;
+        output.seekp(extent.first);
+        pos = decodeStream(compressedData, output, pos);
     }
+    return compare.matches();
+}
 
-    input.close();
-
-    // map for the chars with their respective codes
-    std::map<char, std::string> charWithCode;
-
-    // build a huffman tree with the data in the file
-    buildTree(data, charWithCode);
-
-    // check if there is just one type of char in the file
-    if (charWithCode.size() == 1)
+// 64 bit FNV-1a of the contents. Sparse files hash only their extents, with the offset of each.
+uint64_t huffmanCompress::hashFile(const std::string &path, const std::vector<std::pair<uint64_t, uint64_t>> &extents)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input.is_open())
     {
-        auto &entry = *charWithCode.begin();
-        if (entry.second.empty())
-        {
-            entry.second = "0";
-        }
+        throw std::runtime_error("Failed to open input file!");
     }
 
-    std::string encoded_data;
-    for (char c : data)
-        encoded_data += charWithCode[c];
-
-    // attaching the metadata
-    std::string in = "", s = "";
-
-    in += (char)pq.size();
-    while (!pq.empty())
+    uint64_t hash = fnv1a(nullptr, 0);
+    auto mix = [&hash](const char *data, size_t size)
     {
-        Node *current = pq.extractMin();
-        char ch = current->ch;
-        in += ch;
-
-        int code_size = charWithCode[current->ch].size();
-        in += (char)code_size;
+        hash = fnv1a(data, size, hash);
+    };
 
-        s = charWithCode[current->ch];
-        in += s;
-    }
-
-    // original size of the file for validation (8 bytes)
-    // uint64_t original_size = data.size();
-    // for (int i = 0; i < 8; ++i)
-    // {
-    //     in += (char)(original_size >> (i * 8));
-    // }
-
-    // include the encoded data size including the padding (4 bytes)
-    uint32_t encoded_data_size = encoded_data.size() + 1;
-    for (int i = 0; i < 4; ++i)
+    std::vector<char> buffer(IO_BUFFER_SIZE);
+    if (extents.empty())
     {
-        in += (char)(encoded_data_size >> (i * 8));
+        while (input.read(buffer.data(), buffer.size()) || input.gcount() > 0)
+            mix(buffer.data(), input.gcount());
     }
-
-    // padding the encoded data to be a multiple of 8
-    int padding = (8 - encoded_data.size() % 8) % 8;
-    in += (char)padding;
-    std::string padded_encoded = std::string(padding, '0');
-    padded_encoded += encoded_data;
-    encoded_data = padded_encoded;
-    while (!encoded_data.empty())
+    for (const auto &extent : extents)
     {
-        in += (char)binary_to_decimal(encoded_data.substr(0, 8));
-        encoded_data = encoded_data.substr(8);
-    }
-
-    std::cout << "Compressed: " << inputFilePath << std::endl;
+        std::string offset;
+        appendUint64(offset, extent.first);
+        mix(offset.data(), offset.size());
 
-    return in;
+        input.seekg(extent.first);
+        uint64_t remaining = extent.second;
+        while (remaining > 0)
+        {
+            size_t chunk = std::min<uint64_t>(remaining, buffer.size());
+            if (!input.read(buffer.data(), chunk))
+            {
+                throw std::runtime_error("Failed to read input data!");
+            }
+            mix(buffer.data(), chunk);
+            remaining -= chunk;
+        }
+    }
+    return hash;
 }
-// the inputFilePath is the string with all the compressed code in it
-size_t huffmanCompress::decompressFileUtil(const std::string &compressedData, const std::string &outputFilePath, int pos = 0)
+
+// prints the sizes of one compressed stream and returns the position after it
+size_t huffmanCompress::infoStream(std::string_view compressedData, size_t pos)
 {
+    size_t start = pos;
 
-    std::ofstream output(outputFilePath, std::ios::binary);
-    if (!output.is_open())
+    char flags = compressedData.at(pos);
+    if (flags & STAGE_FLAGS)
     {
-        throw std::runtime_error("Failed to open output file " + outputFilePath);
-    }
+        std::string names;
+        for (const Stage &stage : STAGES)
+        {
+            if (flags & stage.flag)
+                names += std::string(names.empty() ? "" : " + ") + stage.name;
+        }
 
-    // size_t pos = 0;
-    char num_unique = compressedData[pos];
-    pos++;
+        uint64_t original_size = readUint64(compressedData, pos + 1);
+        uint32_t blockSize = readUint32(compressedData, pos + 9);
+        if (blockSize == 0 || blockSize > MAX_STAGE_BLOCK_SIZE)
+        {
+            throw std::runtime_error("Invalid stage block size!");
+        }
+        pos += 13;
 
-    if (num_unique == 0)
-    {
-        output.close();
+        // sizes of the parts summed over the blocks
+        uint64_t blocks = (original_size + blockSize - 1) / blockSize;
+        std::vector<uint64_t> partSizes;
+        for (uint64_t b = 0; b < blocks; b++)
+        {
+            size_t count = (unsigned char)compressedData.at(pos);
+            pos++;
+            partSizes.resize(std::max(partSizes.size(), count));
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t end = skipStream(compressedData, pos);
+                partSizes[i] += end - pos;
+                pos = end;
+            }
+        }
+
+        std::string parts;
+        for (size_t i = 0; i < partSizes.size(); i++)
+            parts += (i ? " + " : "") + std::to_string(partSizes[i]);
+
+        std::cout << "  Original Size: " << original_size << " bytes\n";
+        std::cout << "  Compressed Size: " << pos - start << " bytes\n";
+        std::cout << "  Stages: " << names << " (" << blocks << " blocks, parts of " << parts << " bytes)\n";
         return pos;
     }
+    pos++;
+
+    uint64_t original_size = readUint64(compressedData, pos);
+    pos += 8;
 
-    // building a tree from the metadata
-    std::map<std::string, char> CodeWithChar;
-    for (size_t i = 0; i < num_unique; i++)
+    uint64_t exact_size = 0;
+    if (original_size != 0)
     {
-        char ch = compressedData[pos];
+        // Skip the code table
+        int num_unique = (unsigned char)compressedData.at(pos) + 1;
         pos++;
+        for (int i = 0; i < num_unique; i++)
+        {
+            unsigned char ch_code_size = compressedData.at(pos + 1);
+            pos += 2 + ch_code_size;
+        }
 
-        char ch_code_size = compressedData[pos];
-        pos++;
+        uint64_t payload_size = readUint64(compressedData, pos);
+        pos += 8;
 
-        std::string ch_code = compressedData.substr(pos, ch_code_size);
-        pos += ch_code_size;
+        if (flags & FLAG_SAMPLED)
+        {
+            exact_size = readUint64(compressedData, pos);
+            pos += 8;
+        }
 
-        CodeWithChar[ch_code] = ch;
+        // Skip the compressed data
+        if (pos > compressedData.size() || payload_size > compressedData.size() - pos)
+        {
+            throw std::runtime_error("Compressed data is truncated!");
+        }
+        pos += payload_size;
     }
 
-    uint32_t encoded_data_size = 0;
-    for (int i = 0; i < 4; ++i)
+    std::cout << "  Original Size: " << original_size << " bytes\n";
+    std::cout << "  Compressed Size: " << pos - start << " bytes\n";
+    if (flags & FLAG_SAMPLED)
     {
-        encoded_data_size |= (static_cast<uint32_t>(compressedData[pos + i]) & 0xFF) << (i * 8);
+        double loss = 100.0 * ((double)(pos - start) / exact_size - 1.0);
+        std::cout << "  Table: sampled, " << std::showpos << std::fixed << std::setprecision(2) << loss
+                  << std::noshowpos << "% vs exact (" << exact_size << " bytes)\n";
+        std::cout.unsetf(std::ios::floatfield);
     }
-    pos += 4;
-
-    // read the original size of the file for validation
-    // uint64_t original_size = 0;
-    // for (int i = 0; i < 8; ++i)
-    // {
-    //     original_size |= (static_cast<uint32_t>(compressedData[pos + i]) & 0xFF) << (i * 8);
-    // }
-    // pos += 8;
-
-    // next multiple of 8
-    encoded_data_size = (encoded_data_size + 7) / 8 * 8;
-
-    char padding = compressedData[pos];
-
-    int to = 1 + pos + encoded_data_size / 8;
-    std::string encoded_data;
-    while (pos < to)
+    else if (original_size != 0)
     {
-        char byte = compressedData[pos];
-        pos++;
-
-        encoded_data += std::bitset<8>(byte).to_string();
+        // the stream doesn't record the mode it was compressed in, only whether it was sampled
+        uint64_t threshold = samplingThreshold(sampleStride > 1 ? sampleStride : DEFAULT_SAMPLE_STRIDE);
+        std::cout << "  Table: exact";
+        if (original_size < threshold)
+            std::cout << " (below the sampling threshold of " << threshold << " bytes)";
+        std::cout << "\n";
     }
 
-    // remove the padding
-    encoded_data = encoded_data.substr(8);
-    encoded_data = encoded_data.substr(padding);
-
-    std::string data_decompressd = "";
+    return pos;
+}
 
-    size_t i = 0;
-    while (i < encoded_data.size())
+// returns the position right after the compressed stream starting at pos
+size_t huffmanCompress::skipStream(std::string_view compressedData, size_t pos)
+{
+    char flags = compressedData.at(pos);
+    if (flags & STAGE_FLAGS)
     {
-        std::string code = "";
-        bool found = false;
-
-        while (i < encoded_data.size())
+        uint64_t original_size = readUint64(compressedData, pos + 1);
+        uint32_t blockSize = readUint32(compressedData, pos + 9);
+        if (blockSize == 0 || blockSize > MAX_STAGE_BLOCK_SIZE)
         {
-            code += encoded_data[i];
-            i++;
-
-            // check if the code exists in the map
-            if (CodeWithChar.find(code) != CodeWithChar.end())
-            {
-                data_decompressd += CodeWithChar[code];
-                found = true;
-                break;
-            }
+            throw std::runtime_error("Invalid stage block size!");
         }
+        pos += 13;
 
-        if (!found)
+        for (uint64_t blocks = (original_size + blockSize - 1) / blockSize; blocks > 0; blocks--)
         {
-            if (binary_to_decimal(code) == 0)
-                break;
+            size_t count = (unsigned char)compressedData.at(pos);
+            pos++;
+            for (size_t i = 0; i < count; i++)
+            {
+                // parts are plain streams, a staged one would only come from a corrupt archive
+                if (compressedData.at(pos) & STAGE_FLAGS)
+                {
+                    throw std::runtime_error("Invalid stage parts in compressed data!");
+                }
+                pos = skipStream(compressedData, pos);
+            }
         }
+        return pos;
     }
 
-    // if (original_size == data_decompressd.size()+1)
-    // {
-    //     std::cout << "Decoding successful! " << std::endl;
-    // }
-    // else
-    // {
-    //     // throw std::runtime_error("Decoding failed for " + outputFilePath);
-    // }
+    uint64_t original_size = readUint64(compressedData, pos + 1);
+    pos += 9;
 
-    output.write(data_decompressd.c_str(), data_decompressd.size());
-    output.close();
+    if (original_size == 0)
+        return pos;
 
-    std::cout << "Decompressed: " << outputFilePath << std::endl;
+    // Skip the code table
+    int num_unique = (unsigned char)compressedData.at(pos) + 1;
+    pos++;
+    for (int i = 0; i < num_unique; i++)
+    {
+        unsigned char ch_code_size = compressedData.at(pos + 1);
+        pos += 2 + ch_code_size;
+    }
 
-    return pos;
-}
+    uint64_t payload_size = readUint64(compressedData, pos);
+    pos += 8;
 
-void huffmanCompress::freeTree(Node *node)
-{
-    if (!node)
-        return;
-    if (node->left)
-        freeTree(node->left);
-    if (node->right)
-        freeTree(node->right);
-    delete node;
-}
+    if (flags & FLAG_SAMPLED)
+        pos += 8;
 
-int huffmanCompress::binary_to_decimal(const std::string &in)
-{
-    int result = 0;
-    for (int i = 0; i < in.size(); i++)
-        result = result * 2 + in[i] - '0';
-    return result;
+    if (pos > compressedData.size() || payload_size > compressedData.size() - pos)
+    {
+        throw std::runtime_error("Compressed data is truncated!");
+    }
+    return pos + payload_size;
 }
 
-void huffmanCompress::compressFolder(const std::string &inputFolder)
+void huffmanCompress::info(const std::string &inputFilePath)
 {
-    std::string header;
+    std::string compressed_data = readFile(inputFilePath);
 
-    uint64_t size = 0;
+    std::cout << "Info for: " << inputFilePath << "\n";
+    std::cout << "----------------------------------------\n";
 
-    for (const auto &entry : std::filesystem::recursive_directory_iterator(inputFolder))
-    {
-        std::string relative_path = std::filesystem::relative(entry.path(), inputFolder).string();
+    infoData(compressed_data, inputFilePath);
 
-        if (entry.is_regular_file())
-        {
-            std::string compressed_data = compressFileUtil(entry.path().string());
+    std::cout << "----------------------------------------\n";
+    std::cout << "Total Compressed File Size: " << compressed_data.size() << " bytes\n";
+}
 
-            header += ">" + relative_path + "|";
-            header += compressed_data;
+// the info report of a compressed file or archive held in memory
+void huffmanCompress::infoData(std::string_view compressed_data, const std::string &name)
+{
+    uint64_t directoryOffset;
 
-            size += std::filesystem::file_size(entry.path());
-        }
-        else if (entry.is_directory())
+    if (hasFormat(compressed_data, SEQUENTIAL_MAGIC))
+    {
+        checkFormat(compressed_data, SEQUENTIAL_MAGIC, name);
+        infoSequential(std::string(compressed_data));
+    }
+    else if (hasFormat(compressed_data, FILE_MAGIC))
+    {
+        checkFormat(compressed_data, FILE_MAGIC, name);
+        std::cout << "[File] " << name << "\n";
+        infoStream(compressed_data, FORMAT_HEADER_SIZE);
+    }
+    else
+    {
+        checkFormat(compressed_data, ARCHIVE_MAGIC, name);
+        uint64_t archiveEnd;
+        uint64_t live = FORMAT_HEADER_SIZE;
+        std::map<uint64_t, std::string> streams; // offset -> first file stored there
+        for (const ArchiveEntry &entry : archiveEntries(compressed_data, directoryOffset, archiveEnd))
         {
-            header += "<";
-            header += relative_path + "|";
+            if (entry.type == '<')
+            {
+                std::cout << "[Dir] " << entry.path << "\n";
+            }
+            else if (entry.type == '@')
+            {
+                std::cout << "[Link] " << entry.path << " -> " << entry.target << "\n";
+            }
+            else if (entry.type == '>')
+            {
+                std::cout << "[File] " << entry.path << "\n";
+
+                auto stream = streams.find(entry.offset);
+                if (stream != streams.end())
+                {
+                    std::cout << "  Duplicate of: " << stream->second << "\n";
+                    continue;
+                }
+
+                streams[entry.offset] = entry.path;
+                if (entry.extents.empty())
+                {
+                    live += entry.path.size() + 2 + infoStream(compressed_data, entry.offset) - entry.offset;
+                    continue;
+                }
+
+                size_t end = skipEntry(compressed_data, entry);
+                uint64_t data = 0;
+                for (const auto &extent : entry.extents)
+                    data += extent.second;
+
+                std::cout << "  Original Size: " << entry.size << " bytes\n";
+                std::cout << "  Compressed Size: " << end - entry.offset << " bytes\n";
+                std::cout << "  Sparse: " << entry.extents.size() << " extents, " << data << " bytes of data\n";
+                live += entry.path.size() + 2 + end - entry.offset;
+            }
         }
-    }
-
-    std::ofstream outFile(inputFolder + ".huff", std::ios::binary);
-    outFile.write(header.c_str(), header.size());
-    outFile.close();
-
-    uint64_t newSize = std::filesystem::file_size(inputFolder + ".huff");
 
-    std::cout << "Compression complete! " << std::endl;
-    std::cout << "Size before compression: " << size << " bytes" << std::endl;
-    std::cout << "Size after compression: " << newSize << " bytes" << std::endl
-              << std::endl;
+        std::cout << "----------------------------------------\n";
+        std::cout << "Dead Space: " << directoryOffset - live << " bytes\n";
+        if (archiveEnd < compressed_data.size())
+            std::cout << "Incomplete Tail: " << compressed_data.size() - archiveEnd << " bytes (an interrupted update)\n";
+    }
 }
 
-void huffmanCompress::decompressFolder(const std::string &inputFolder)
+// every mode the benchmark and the self test run
+const huffmanCompress::CodecMode huffmanCompress::CODEC_MODES[5] = {
+    {"exact", false, 0},
+    {"sampled", true, 0},
+    {"rle", false, FLAG_RLE},
+    {"bwt", false, FLAG_BWT},
+    {"bwt+rle", false, FLAG_BWT | FLAG_RLE},
+};
+
+// compresses and decompresses in memory with the current mode, throws unless the original comes back
+std::string huffmanCompress::roundTrip(const std::string &original, double &encodeSeconds, double &decodeSeconds)
 {
-    std::ifstream input(inputFolder, std::ios::binary);
-    if (!input)
+    std::istringstream input(original);
+    std::ostringstream compressed;
+    auto start = std::chrono::steady_clock::now();
+    encodeStream(input, original.size(), compressed);
+    auto encoded = std::chrono::steady_clock::now();
+
+    std::string compressed_data = compressed.str();
+    std::ostringstream restored;
+    decodeStream(compressed_data, restored, 0);
+    auto decoded = std::chrono::steady_clock::now();
+
+    if (restored.str() != original)
     {
-        throw std::runtime_error("Failed to open compressed file for reading.");
+        throw std::runtime_error("Round trip failed!");
     }
 
-    std::string folderName = "huff_" + inputFolder.substr(0, inputFolder.size() - 5);
-    std::filesystem::create_directories(folderName);
+    encodeSeconds = std::chrono::duration<double>(encoded - start).count();
+    decodeSeconds = std::chrono::duration<double>(decoded - encoded).count();
+    return compressed_data;
+}
 
-    std::string compressed_data;
-    char c;
-    while (input.get(c))
+// compresses a file in memory in exact and sampled mode and with the pre-pass stages, checking every round trip
+void huffmanCompress::benchmark(const std::string &inputFilePath)
+{
+    std::ifstream input(inputFilePath, std::ios::binary);
+    if (!input.is_open())
     {
-        compressed_data += c;
+        throw std::runtime_error("Failed to open input file!");
     }
+    input.close();
 
-    int pos = 0;
-    while (pos < compressed_data.size())
-    {
-        char type = compressed_data[pos];
-        pos++;
+    std::string original = readFile(inputFilePath);
+    uint64_t size = original.size();
 
-        size_t pathEnd = compressed_data.find('|', pos);
-        // some check if there is an error in the compression
+    int savedStride = sampleStride;
+    char savedStages = stages;
+    uint64_t exactSize = 0;
 
-        std::string relativePath = compressed_data.substr(pos, pathEnd - pos);
-        pos = pathEnd + 1;
+    std::cout << "Benchmark for: " << inputFilePath << " (" << size << " bytes)\n";
+    std::cout << "----------------------------------------\n";
+    std::cout << std::fixed << std::setprecision(2);
 
-        std::string fullpath = folderName + "\\" + relativePath;
+    for (const CodecMode &mode : CODEC_MODES)
+    {
+        sampleStride = !mode.sampled ? 0 : savedStride > 1 ? savedStride : DEFAULT_SAMPLE_STRIDE;
+        stages = mode.stages;
 
-        // dictionary
-        if (type == '<')
+        std::string compressed_data;
+        double encodeSeconds, decodeSeconds;
+        try
         {
-            std::filesystem::create_directories(fullpath);
+            compressed_data = roundTrip(original, encodeSeconds, decodeSeconds);
         }
-        if (type == '>')
+        catch (...)
         {
-            pos = decompressFileUtil(compressed_data, fullpath, pos);
+            sampleStride = savedStride;
+            stages = savedStages;
+            throw;
         }
-    }
-    std::cout << "Decompression complete! " << std::endl
-              << std::endl;
-}
 
-void huffmanCompress::info(const std::string &inputFilePath)
-{
-    std::ifstream input(inputFilePath, std::ios::binary);
-    if (!input)
-    {
-        throw std::runtime_error("Failed to open compressed file for reading.");
+        double mb = size / (1024.0 * 1024.0);
+
+        std::cout << std::left << std::setw(7) << mode.name << std::right << "  "
+                  << compressed_data.size() << " bytes, ratio "
+                  << (size ? (double)compressed_data.size() / size : 0.0) << ", "
+                  << "compress " << mb / encodeSeconds << " MB/s, "
+                  << "decompress " << mb / decodeSeconds << " MB/s";
+
+        if (exactSize == 0)
+            exactSize = compressed_data.size();
+        else if (mode.sampled && size < samplingThreshold(sampleStride))
+            std::cout << ", below the sampling threshold of " << samplingThreshold(sampleStride) << " bytes, exact mode used";
+        else
+            std::cout << ", " << std::showpos << 100.0 * ((double)compressed_data.size() / exactSize - 1.0)
+                      << std::noshowpos << "% vs exact";
+        std::cout << "\n";
+
+        if (mode.stages & FLAG_BWT)
+            reportBlockMemory();
     }
 
-    std::string compressed_data;
-    char c;
-    while (input.get(c))
+    sampleStride = savedStride;
+    stages = savedStages;
+
+    // the encoder kernels alone, in memory with the exact table
+    std::vector<uint64_t> freq(256, 0);
+    for (char c : original)
+        freq[(unsigned char)c]++;
+
+    std::map<char, std::string> charWithCode;
+    EncodeTable table = {};
+    if (size > 0)
     {
-        compressed_data += c;
+        buildTree(freq, charWithCode);
+        table = makeEncodeTable(charWithCode);
     }
 
-    std::cout << "Info for: " << inputFilePath << "\n";
-    std::cout << "----------------------------------------\n";
-
-    int pos = 0;
-    while (pos < compressed_data.size())
+    if (size > 0)
     {
-        char type = compressed_data[pos];
-        pos++;
+        std::vector<unsigned char> scalar(size * table.max_length / 8 + 16);
+        std::vector<unsigned char> vector(scalar.size());
+        double mb = size / (1024.0 * 1024.0);
 
-        size_t pathEnd = compressed_data.find('|', pos);
-        if (pathEnd == std::string::npos)
-        {
-            throw std::runtime_error("Invalid compressed file format.");
-        }
+        BitWriter writer;
+        writer.out = scalar.data();
+        auto start = std::chrono::steady_clock::now();
+        encodeScalar(table, (const unsigned char *)original.data(), size, writer);
+        auto end = std::chrono::steady_clock::now();
+        size_t scalarBytes = writer.out - scalar.data();
 
-        std::string relativePath = compressed_data.substr(pos, pathEnd - pos);
-        pos = pathEnd + 1;
+        std::cout << "encoder  scalar " << mb / std::chrono::duration<double>(end - start).count() << " MB/s";
 
-        if (type == '<')
+        if (table.max_length <= MAX_VECTOR_CODE_SIZE && cpuHasAVX2())
         {
-            std::cout << "[Dir] " << relativePath << "\n";
-        }
-        else if (type == '>')
-        {
-            std::cout << "[File] " << relativePath << "\n";
+            writer = BitWriter();
+            writer.out = vector.data();
+            start = std::chrono::steady_clock::now();
+            encodeChunk(table, (const unsigned char *)original.data(), size, writer);
+            end = std::chrono::steady_clock::now();
 
-            // Extract the compressed data size
-            uint32_t encoded_data_size = 0;
-            for (int i = 0; i < 4; ++i)
+            if ((size_t)(writer.out - vector.data()) != scalarBytes || !std::equal(scalar.begin(), scalar.begin() + scalarBytes, vector.begin()))
             {
-                encoded_data_size |= (static_cast<uint32_t>(compressed_data[pos + i]) & 0xFF) << (i * 8);
+                throw std::runtime_error("AVX2 encoder output differs from the scalar encoder!");
             }
-            pos += 4;
 
-            // Skip the padding and compressed data
-            char padding = compressed_data[pos];
-            pos++;
-
-            int to = pos + (encoded_data_size + 7) / 8;
-            pos = to;
-
-            std::cout << "  Compressed Size: " << (encoded_data_size + 7) / 8 << " bytes\n";
+            std::cout << ", avx2 " << mb / std::chrono::duration<double>(end - start).count() << " MB/s";
         }
+        std::cout << "\n";
     }
 
+    std::cout.unsetf(std::ios::floatfield);
     std::cout << "----------------------------------------\n";
-    std::cout << "Total Compressed File Size: " << compressed_data.size() << " bytes\n";
 }
 
 void displayMenu()
@@ -676,13 +3168,21 @@ void displayMenu()
     std::cout << "3. Compress Folder\n";
     std::cout << "4. Decompress Folder\n";
     std::cout << "5. Info\n";
-    std::cout << "6. Exit\n";
+    std::cout << "6. Compression Mode\n";
+    std::cout << "7. Benchmark\n";
+    std::cout << "8. Update Folder Archive\n";
+    std::cout << "9. Compact Folder Archive\n";
+    std::cout << "10. Compress Folder (Sequential)\n";
+    std::cout << "11. Exit\n";
     std::cout << "Enter your choice: ";
 }
 
 void handleUserChoice(int choice, huffmanCompress &h)
 {
     std::string path;
+    std::string outputPath;
+    int percent;
+    char answer;
     switch (choice)
     {
     case 1:
@@ -711,6 +3211,41 @@ void handleUserChoice(int choice, huffmanCompress &h)
         h.info(path);
         break;
     case 6:
+        std::cout << "Enter the sampling percent (0 for the exact histogram): ";
+        std::cin >> percent;
+        h.setSampling(percent);
+        std::cout << "Collapse byte runs before coding? (y/n): ";
+        std::cin >> answer;
+        h.setRunLength(answer == 'y');
+        std::cout << "Block sort (BWT + move-to-front) for the highest ratio? (y/n): ";
+        std::cin >> answer;
+        h.setBlockSorting(answer == 'y');
+        break;
+    case 7:
+        std::cout << "Enter the file path to benchmark: ";
+        std::cin >> path;
+        h.benchmark(path);
+        break;
+    case 8:
+        std::cout << "Enter the folder path to update: ";
+        std::cin >> path;
+        std::cout << "Verify unchanged files by content hash? (y/n): ";
+        std::cin >> answer;
+        h.updateFolder(path, answer == 'y');
+        break;
+    case 9:
+        std::cout << "Enter the archive path to compact: ";
+        std::cin >> path;
+        h.compactFolder(path);
+        break;
+    case 10:
+        std::cout << "Enter the folder path to compress: ";
+        std::cin >> path;
+        std::cout << "Enter the output path (a file, pipe or tape device): ";
+        std::cin >> outputPath;
+        h.compressFolderSequential(path, outputPath);
+        break;
+    case 11:
         std::cout << "Exiting...\n";
         break;
     default:
@@ -719,16 +3254,31 @@ void handleUserChoice(int choice, huffmanCompress &h)
     }
 }
 
+// the self test and the fuzz target bring their own main, see the README
+#ifndef HUFFMAN_NO_MAIN
 int main()
 {
     huffmanCompress h;
+
     int choice;
     do
     {
         displayMenu();
-        std::cin >> choice;
-        handleUserChoice(choice, h);
-    } while (choice != 6);
+        if (!(std::cin >> choice))
+            break;
+
+        // a failed action is reported and the menu shown again, partial outputs are removed on the way
+        try
+        {
+            handleUserChoice(choice, h);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "Error: " << e.what() << std::endl
+                      << std::endl;
+        }
+    } while (choice != 11);
 
     return 0;
 }
+#endif
@@ -2,23 +2,29 @@
 #include <string>
 #include <vector>
 #include <iostream>
-#include "minHeap.cpp"
+#include "minHeap.h"
 #include <bitset>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <map>
 #include <unordered_map>
 #include <stdexcept>
+#include <cstdint>
+#include <array>
+#include <tuple>
+#include <string_view>
+#include <memory>
 
 struct Node
 {
-    int freq;
+    uint64_t freq;
     Node *left;
     Node *right;
     std::string code;
     char ch = 0;
-    Node(char ch, int freq) : ch(ch), freq(freq), left(nullptr), right(nullptr) {}
-    Node(char ch, int freq, Node *left, Node *right) : ch(ch), freq(freq), left(left), right(right) {}
+    Node(char ch, uint64_t freq) : ch(ch), freq(freq), left(nullptr), right(nullptr) {}
+    Node(char ch, uint64_t freq, Node *left, Node *right) : ch(ch), freq(freq), left(left), right(right) {}
 };
 
 struct CompareNode
@@ -29,30 +35,254 @@ struct CompareNode
     }
 };
 
+// codes as right aligned integers for the packed encoders
+struct EncodeTable
+{
+    uint64_t code[256];
+    unsigned char length[256];
+    uint32_t packed[256]; // code | length << 16, for the short codes of the AVX2 encoder
+    int max_length;
+};
+
+// packed output of the encoders, pending bits are kept left aligned in acc
+struct BitWriter
+{
+    uint64_t acc = 0;
+    int count = 0;
+    unsigned char *out = nullptr;
+};
+
+// entry of the decode table, indexed by the next bits of the payload
+struct DecodeEntry
+{
+    unsigned char symbol;
+    unsigned char length; // 0 marks a bit pattern that starts no code
+};
+
+// one record of a folder archive directory
+struct ArchiveEntry
+{
+    char type = 0;       // '>' file, '<' directory, '@' symlink
+    std::string path;    // relative to the archived folder
+    uint64_t size = 0;   // original file size
+    int64_t mtime = 0;   // last write time of the source file, seconds since the Unix epoch
+    uint32_t mtimeNsec = 0; // and nanoseconds
+    uint64_t hash = 0;   // FNV-1a of the file contents
+    uint64_t offset = 0; // start of the compressed stream in the archive
+    uint32_t mode = 0;
+    uint32_t uid = 0;
+    uint32_t gid = 0;
+    std::string target;  // symlinks only
+    // (offset, length) of the data regions of a sparse file, one stream each, stored back to back.
+    // Empty for dense files, which have a single stream.
+    std::vector<std::pair<uint64_t, uint64_t>> extents;
+};
+
+// read-only view of a whole file. Memory mapped where possible, so extracting from a large archive
+// reads its pages on demand instead of holding all of it on the heap.
+class mappedFile
+{
+private:
+    const char *data;
+    size_t size;
+    std::string contents; // where the file can't be mapped
+
+public:
+    explicit mappedFile(const std::string &path);
+    mappedFile(const mappedFile &) = delete;
+    mappedFile &operator=(const mappedFile &) = delete;
+
+    std::string_view view() const { return std::string_view(data, size); };
+
+    ~mappedFile();
+};
+
+// a file written by extraction. It is always a new file: a symlink at the path is refused instead of
+// followed and a regular file there is replaced, O_NOFOLLOW | O_EXCL where available. A file that
+// isn't closed, because decoding it threw, is removed again.
+class outputFile
+{
+private:
+    std::string path;
+    std::unique_ptr<std::streambuf> buffer;
+
+public:
+    std::ostream stream;
+
+    explicit outputFile(const std::string &path);
+    outputFile(const outputFile &) = delete;
+    outputFile &operator=(const outputFile &) = delete;
+
+    void close();
+
+    ~outputFile();
+};
+
 class huffmanCompress
 {
 private:
+    // stream flags (first byte of every compressed stream)
+    static constexpr char FLAG_SAMPLED = 1;
+    static constexpr char FLAG_RLE = 2;
+    static constexpr char FLAG_BWT = 4;
+    static constexpr char STAGE_FLAGS = FLAG_RLE | FLAG_BWT;
+
+    // shortest run the RLE stage collapses
+    static constexpr size_t RUN_THRESHOLD = 4;
+    // the BWT stage sorts blocks of this size independently
+    static constexpr size_t BWT_BLOCK_SIZE = 1 << 20;
+    // staged streams are transformed in blocks of this size, which bounds their memory
+    static constexpr size_t STAGE_BLOCK_SIZE = 8 << 20;
+    // largest block size the decoder accepts, bounds what a corrupt header can make it allocate
+    static constexpr size_t MAX_STAGE_BLOCK_SIZE = 64 << 20;
+
+    // a reversible transform run before the Huffman coder, every part it produces gets its own table
+    struct Stage
+    {
+        char flag;
+        const char *name;
+        size_t sideParts;
+        std::string (huffmanCompress::*encode)(const std::string &data, std::vector<std::string> &side);
+        std::string (huffmanCompress::*decode)(const std::string &data, const std::string *side, uint64_t maxSize);
+    };
+    static const Stage STAGES[];
+
+    static constexpr size_t IO_BUFFER_SIZE = 1 << 16;
+    static constexpr size_t SAMPLE_BLOCK_SIZE = 4096;
+    static constexpr int DEFAULT_SAMPLE_STRIDE = 32; // ~3% of the blocks
+    // inputs that would give fewer sampled blocks are counted exactly, the full read is cheap there
+    // and a small stream can't carry the code table of every byte value
+    static constexpr uint64_t MIN_SAMPLED_BLOCKS = 16;
+
+    // longest codes the AVX2 encoder takes
+    static constexpr int MAX_VECTOR_CODE_SIZE = 14;
+    // longest code buildTree produces, so every stream decodes with a table kernel and
+    // encodes with the AVX2 kernel where available
+    static constexpr int MAX_CODE_SIZE = MAX_VECTOR_CODE_SIZE;
+
+    // Compressed files, folder archives and sequential archives start with their magic and
+    // FORMAT_VERSION. The original format had no header, its files are rejected.
+    static constexpr char FILE_MAGIC[] = "HUFF";
+    static constexpr char ARCHIVE_MAGIC[] = "HARC";
+    static constexpr char FORMAT_VERSION = 2;
+    static constexpr size_t FORMAT_HEADER_SIZE = 4 + 1;
+
+    // folder archives end with the directory offset (8), its FNV-1a (8) and this magic
+    static constexpr char DIRECTORY_MAGIC[] = "HDIR";
+    static constexpr size_t TRAILER_SIZE = 8 + 8 + 4;
+
+    // a mode of the benchmark and the self test
+    struct CodecMode
+    {
+        const char *name;
+        bool sampled;
+        char stages;
+    };
+    static const CodecMode CODEC_MODES[5];
+
+    // sequential archives start with this magic, file data is compressed in independent blocks
+    static constexpr char SEQUENTIAL_MAGIC[] = "HSEQ";
+    static constexpr size_t SEQUENTIAL_BLOCK_SIZE = 1 << 20;
+    static constexpr size_t SEQUENTIAL_HEADER_SIZE = 1 + 4 + 8 + 4 + 8;
+
     Node *root;
-    minHeap<Node *, CompareNode> pq;
+    // 0 builds the exact histogram, otherwise every n-th block is sampled
+    int sampleStride;
+    // STAGE_FLAGS of the pre-pass stages new streams go through
+    char stages;
+    // largest suffix sorting memory of a BWT block and most blocks sorted at once, since the last report
+    size_t blockMemory;
+    size_t blockThreads;
+
+    std::string compressFileUtil(const std::string &, const std::vector<std::pair<uint64_t, uint64_t>> &extents = {});
+    size_t decompressFileUtil(std::string_view, const std::string &, size_t);
+
+    EncodeTable makeEncodeTable(const std::map<char, std::string> &charWithCode);
+    // vector = false forces the scalar kernel
+    void encodeChunk(const EncodeTable &table, const unsigned char *in, size_t n, BitWriter &writer, bool vector = true);
 
-    std::string compressFileUtil(const std::string &);
-    size_t decompressFileUtil(const std::string &, const std::string &, int);
+    void encodeStream(std::istream &input, uint64_t size, std::ostream &output);
+    size_t decodeStream(std::string_view compressedData, std::ostream &output, size_t pos);
+    void encodeHuffman(std::istream &input, uint64_t size, std::ostream &output);
+    size_t decodeHuffman(std::string_view compressedData, std::ostream &output, size_t pos);
+    size_t decodeStageBlock(std::string_view compressedData, std::ostream &output, size_t pos, char flags, uint64_t original_size);
+    std::string rleEncode(const std::string &data, std::vector<std::string> &side);
+    std::string rleDecode(const std::string &data, const std::string *side, uint64_t maxSize);
+    std::string bwtEncode(const std::string &data, std::vector<std::string> &side);
+    std::string bwtDecode(const std::string &data, const std::string *side, uint64_t maxSize);
+    void reportBlockMemory();
+    std::string roundTrip(const std::string &original, double &encodeSeconds, double &decodeSeconds);
+    // decodes count symbols with the kernel for codes of at most maxLength bits
+    void decodePayload(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count, int maxLength);
+    template <int MAX_LEN>
+    void decodeKernel(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count);
+    void decodeGeneric(const std::vector<std::pair<std::string, char>> &codes, const unsigned char *in, size_t inSize, std::ostream &output, uint64_t count);
+    void infoData(std::string_view compressedData, const std::string &name);
+    size_t infoStream(std::string_view compressedData, size_t pos);
+    size_t skipStream(std::string_view compressedData, size_t pos);
 
-    void buildTree(const std::string &text, std::map<char, std::string> &charWithCode);
+    std::string formatHeader(const char *magic);
+    bool hasFormat(std::string_view data, const char *magic);
+    void checkFormat(std::string_view data, const char *magic, const std::string &path);
+    bool readTrailer(std::string_view archive, uint64_t &directoryOffset, uint64_t &archiveEnd);
+    std::vector<ArchiveEntry> readDirectory(const std::string &archivePath, uint64_t &directoryOffset, uint64_t &archiveEnd);
+    std::vector<ArchiveEntry> archiveEntries(std::string_view compressedData, uint64_t &directoryOffset, uint64_t &archiveEnd);
+    std::vector<ArchiveEntry> parseDirectory(std::string_view directory);
+    std::string serializeDirectory(const std::vector<ArchiveEntry> &entries, uint64_t directoryOffset);
+    uint64_t hashFile(const std::string &path, const std::vector<std::pair<uint64_t, uint64_t>> &extents);
+    bool sameContents(std::string_view compressedData, const ArchiveEntry &stored, const std::string &path,
+                      const std::vector<std::pair<uint64_t, uint64_t>> &extents);
+    ArchiveEntry makeEntry(const std::filesystem::directory_entry &entry, const std::string &relativePath);
+    std::vector<std::pair<uint64_t, uint64_t>> dataExtents(const std::string &path, uint64_t size);
+    size_t skipEntry(std::string_view compressedData, const ArchiveEntry &entry);
+    void extractFile(std::string_view compressedData, const ArchiveEntry &entry, const std::string &path);
+
+    void decompressFolderSequential(std::istream &input, const std::string &folderName);
+    void infoSequential(const std::string &compressedData);
+    std::string extractPath(const std::string &folderName, const std::string &path);
+    void restoreMetadata(const std::string &path, uint32_t mode, int64_t mtime, uint32_t mtimeNsec);
+    void restoreOwner(const std::string &path, uint32_t uid, uint32_t gid);
+
+    std::vector<uint64_t> countFrequencies(std::istream &input, uint64_t size);
+    std::vector<uint64_t> sampleFrequencies(std::istream &input, uint64_t size);
+    uint64_t samplingThreshold(int stride);
+    uint64_t exactStreamSize(const std::vector<uint64_t> &freq);
+
+    void buildTree(const std::vector<uint64_t> &freq, std::map<char, std::string> &charWithCode);
     void generateCodes(Node *root, const std::string &code, std::map<char, std::string> &charWithCode);
+    void limitCodeLengths(const std::vector<uint64_t> &freq, std::map<char, std::string> &charWithCode);
     void freeTree(Node *node);
 
     int binary_to_decimal(const std::string &in);
+    void appendUint32(std::string &out, uint32_t value);
+    uint32_t readUint32(std::string_view in, size_t pos);
+    void appendUint64(std::string &out, uint64_t value);
+    uint64_t readUint64(std::string_view in, size_t pos);
+    std::string readBytes(std::istream &input, size_t size);
+    std::string readFile(const std::string &path);
+
+    // huffmanSelfTest.cpp and huffmanFuzz.cpp test the private coders directly
+    friend class huffmanSelfTest;
+    friend class huffmanFuzz;
+
 public:
-    huffmanCompress() : root(nullptr) {}
+    huffmanCompress() : root(nullptr), sampleStride(0), stages(0), blockMemory(0), blockThreads(0) {}
 
     void compressFile(const std::string &);
     void decompressFile(const std::string &);
 
     void compressFolder(const std::string &);
     void decompressFolder(const std::string &);
+    void updateFolder(const std::string &, bool compareHashes);
+    void compactFolder(const std::string &);
+    void compressFolderSequential(const std::string &, const std::string &);
 
     void info(const std::string &);
+    void benchmark(const std::string &);
+
+    void setSampling(int percent);
+    void setRunLength(bool enabled);
+    void setBlockSorting(bool enabled);
 
     ~huffmanCompress() { freeTree(root); };
 };
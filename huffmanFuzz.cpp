@@ -0,0 +1,70 @@
+#include "huffmanCompress.h"
+#include <set>
+
+// libFuzzer target, see the README for the build line. A friend of huffmanCompress, so it reaches
+// the stream and archive readers directly.
+class huffmanFuzz
+{
+public:
+    static void inspect(std::string_view data);
+};
+
+// Runs the info report and every decoder over arbitrary bytes, for fuzzing. Malformed input has
+// to end in an exception, a crash, a sanitizer report or a hang is a bug.
+void huffmanFuzz::inspect(std::string_view data)
+{
+    huffmanCompress h;
+    std::ostream discard(nullptr);
+    std::streambuf *console = std::cout.rdbuf(nullptr);
+
+    try
+    {
+        h.infoData(data, "input");
+    }
+    catch (const std::exception &)
+    {
+    }
+
+    // as a single compressed file
+    try
+    {
+        h.checkFormat(data, huffmanCompress::FILE_MAGIC, "input");
+        h.decodeStream(data, discard, huffmanCompress::FORMAT_HEADER_SIZE);
+    }
+    catch (const std::exception &)
+    {
+    }
+
+    // as a folder archive, every stream once
+    try
+    {
+        uint64_t directoryOffset, archiveEnd;
+        std::set<uint64_t> decoded;
+        for (const ArchiveEntry &entry : h.archiveEntries(data, directoryOffset, archiveEnd))
+        {
+            if (entry.type != '>' || !decoded.insert(entry.offset).second)
+                continue;
+
+            try
+            {
+                size_t pos = entry.offset;
+                for (size_t i = 0; i < std::max<size_t>(entry.extents.size(), 1); i++)
+                    pos = h.decodeStream(data, discard, pos);
+            }
+            catch (const std::exception &)
+            {
+            }
+        }
+    }
+    catch (const std::exception &)
+    {
+    }
+
+    std::cout.rdbuf(console);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    huffmanFuzz::inspect(std::string_view((const char *)data, size));
+    return 0;
+}
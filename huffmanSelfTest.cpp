@@ -0,0 +1,485 @@
+#include "huffmanCompress.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+
+// Regression gate of the codec, built as its own program with the codec (see the README):
+//   huffmanSelfTest [baseline] [threshold %]   runs the checks, against the baseline if given
+//   huffmanSelfTest --write-baseline baseline  records the speeds and sizes to compare against
+// A friend of huffmanCompress, so it checks the private encoders and decoders directly.
+class huffmanSelfTest
+{
+private:
+    // the best MB/s of SELF_TEST_RUNS samples is taken of the corpora of at least MIN_TIMED_SIZE,
+    // a sample repeats the round trip for at least SELF_TEST_SAMPLE_SECONDS so a fast mode isn't
+    // timed over a few ms. The calibration loop runs for SELF_TEST_SECONDS first.
+    static constexpr int SELF_TEST_RUNS = 10;
+    static constexpr double SELF_TEST_SAMPLE_SECONDS = 0.01;
+    static constexpr double SELF_TEST_SECONDS = 0.25;
+    static constexpr size_t MIN_TIMED_SIZE = 64 << 10;
+    // baseline line of the calibration loop, timed again for CALIBRATION_SECONDS before every sample
+    static constexpr char CALIBRATION_LABEL[] = "calibration fnv-1a";
+    static constexpr double CALIBRATION_SECONDS = 0.005;
+    // a mode below the threshold is measured this many times in all before it fails
+    static constexpr int CONFIRM_MEASUREMENTS = 3;
+    // The 1 MiB corpora are below the sampling threshold of DEFAULT_SAMPLE_STRIDE, so the sampled mode
+    // uses this stride to go through the sampled path (the threshold is 512 KiB at 8)
+    static constexpr int SELF_TEST_SAMPLE_STRIDE = 8;
+
+    huffmanCompress codec;
+
+    void checkCoders(const std::string &data);
+
+public:
+    // a mode running more than this fraction below its baseline MB/s fails. Repeated runs against
+    // one baseline on a shared single core VM were up to 16% slower (3% median, 12% p99).
+    static constexpr double REGRESSION_THRESHOLD = 0.20;
+
+    int run(const std::string &baselinePath, double threshold = REGRESSION_THRESHOLD, bool writeBaseline = false);
+};
+
+// fixed seed corpora of the self test, each one aimed at a different path of the coder
+static std::vector<std::pair<std::string, std::string>> selfTestCorpora()
+{
+    const size_t size = 1 << 20;
+    std::mt19937 rng(20240601);
+    std::vector<std::pair<std::string, std::string>> corpora;
+
+    corpora.push_back({"empty", ""});
+    corpora.push_back({"single", "x"});
+    corpora.push_back({"one-symbol", std::string(size, 'a')});
+
+    // all 256 symbols, so the table stores num_unique - 1 = 255
+    std::string uniform(size, 0);
+    for (char &c : uniform)
+        c = (char)rng();
+    corpora.push_back({"uniform", uniform});
+
+    // a few very common bytes and a long tail
+    std::geometric_distribution<int> geometric(0.15);
+    std::string skewed(size, 0);
+    for (char &c : skewed)
+        c = (char)std::min(geometric(rng), 255);
+    corpora.push_back({"skewed", skewed});
+
+    // words of a small vocabulary with a Zipf like spread
+    std::vector<std::string> words(2000);
+    for (std::string &word : words)
+    {
+        for (size_t n = 2 + rng() % 8; n > 0; n--)
+            word += (char)('a' + rng() % 26);
+    }
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::string text;
+    while (text.size() < size)
+    {
+        text += words[(size_t)(std::pow(unit(rng), 3) * words.size())];
+        text += rng() % 12 ? " " : "\n    ";
+    }
+    text.resize(size);
+    corpora.push_back({"text", text});
+
+    // mostly zero pages, as in disk images and padded binaries
+    std::string pages(size, 0);
+    for (size_t page = 0; page < size; page += 4096)
+    {
+        if (rng() % 4 == 0)
+        {
+            for (size_t i = page; i < page + 4096; i++)
+                pages[i] = (char)rng();
+        }
+    }
+    corpora.push_back({"zero-pages", pages});
+
+    // Fibonacci frequencies build the deepest tree, 24 bits before the codes are length limited
+    std::string fibonacci;
+    uint64_t a = 1, b = 1;
+    for (int symbol = 0; symbol < 25; symbol++)
+    {
+        fibonacci.append(a, (char)symbol);
+        std::tie(a, b) = std::make_tuple(b, a + b);
+    }
+    std::shuffle(fibonacci.begin(), fibonacci.end(), rng);
+    corpora.push_back({"long-codes", fibonacci});
+
+    return corpora;
+}
+
+// MB/s of a fixed FNV-1a loop, the self test scales the baseline by it so a machine that is busier
+// or slower than when the baseline was taken doesn't read as a regression. Always optimized where
+// the compiler allows it, so a build with worse flags still shows up as slower.
+static volatile uint64_t calibrationSink;
+
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("O2")))
+#endif
+static double calibrationSpeed(double seconds)
+{
+    std::string data(1 << 16, 0);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (char)(i * 131);
+
+    double best = HUGE_VAL, spent = 0;
+    while (spent < seconds)
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : data)
+        {
+            hash ^= (unsigned char)c;
+            hash *= 1099511628211ULL;
+        }
+        calibrationSink = hash;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, elapsed);
+        spent += elapsed;
+    }
+    return data.size() / (1024.0 * 1024.0) / best;
+}
+
+// The packed encoders against the reference string encoder, and every decoder the code lengths
+// allow against the original. Throws on the first difference.
+void huffmanSelfTest::checkCoders(const std::string &data)
+{
+    if (data.empty())
+        return;
+
+    std::vector<uint64_t> freq(256, 0);
+    for (char c : data)
+        freq[(unsigned char)c]++;
+
+    std::map<char, std::string> charWithCode;
+    codec.buildTree(freq, charWithCode);
+    EncodeTable table = codec.makeEncodeTable(charWithCode);
+
+    // the code strings, padded to a multiple of 8 and packed 8 bits at a time
+    std::string bits;
+    std::string expected;
+    auto pack = [&]()
+    {
+        size_t bytes = bits.size() / 8;
+        for (size_t i = 0; i < bytes; i++)
+            expected += (char)codec.binary_to_decimal(bits.substr(i * 8, 8));
+        bits.erase(0, bytes * 8);
+    };
+    for (char c : data)
+    {
+        bits += charWithCode[c];
+        if (bits.size() >= huffmanCompress::IO_BUFFER_SIZE)
+            pack();
+    }
+    bits.append((8 - bits.size() % 8) % 8, '0');
+    pack();
+
+    const unsigned char *in = (const unsigned char *)data.data();
+    for (bool dispatched : {false, true})
+    {
+        std::vector<unsigned char> packed(data.size() * table.max_length / 8 + 16);
+        BitWriter writer;
+        writer.out = packed.data();
+        codec.encodeChunk(table, in, data.size(), writer, dispatched);
+        if (writer.count > 0)
+            *writer.out++ = (unsigned char)(writer.acc >> 56);
+
+        if ((size_t)(writer.out - packed.data()) != expected.size() || !std::equal(expected.begin(), expected.end(), (const char *)packed.data()))
+        {
+            throw std::runtime_error(std::string(dispatched ? "encodeChunk" : "scalar encoder") + " output differs from the string encoder!");
+        }
+    }
+
+    std::vector<std::pair<std::string, char>> codes;
+    for (const auto &code : charWithCode)
+        codes.push_back({code.second, code.first});
+
+    std::pair<const char *, int> decoders[] = {
+        {"11 bit table", 11},
+        {"12 bit table", 12},
+        {"14 bit table", 14},
+        {"tree walk", 255},
+    };
+    for (const auto &decoder : decoders)
+    {
+        if (table.max_length > decoder.second)
+            continue;
+
+        std::ostringstream restored;
+        codec.decodePayload(codes, (const unsigned char *)expected.data(), expected.size(), restored, data.size(), decoder.second);
+        if (restored.str() != data)
+        {
+            throw std::runtime_error(std::string(decoder.first) + " decoder output differs from the original!");
+        }
+    }
+}
+
+// Round trips every codec mode on the self test corpora and checks the encoders and decoders
+// against the reference ones. With a baseline file the MB/s and sizes are compared to it. A
+// baseline that is missing, malformed or lacks a mode fails, writeBaseline records a new one
+// instead when every check passes. Returns 1 on any failure, for scripts and CI.
+// Baseline lines: corpus mode compress MB/s decompress MB/s compressed size
+int huffmanSelfTest::run(const std::string &baselinePath, double threshold, bool writeBaseline)
+{
+    std::map<std::string, std::tuple<double, double, uint64_t>> baseline;
+    if (!baselinePath.empty() && !writeBaseline)
+    {
+        std::ifstream input(baselinePath);
+        if (!input)
+        {
+            throw std::runtime_error("Missing baseline " + baselinePath + ", record one with --write-baseline");
+        }
+
+        std::string line;
+        while (std::getline(input, line))
+        {
+            std::istringstream fields(line);
+            std::string corpus, mode, extra;
+            double compressMBs, decompressMBs;
+            uint64_t size;
+            if (!(fields >> corpus >> mode >> compressMBs >> decompressMBs >> size) || fields >> extra)
+            {
+                throw std::runtime_error("Invalid baseline line: " + line);
+            }
+            baseline[corpus + " " + mode] = {compressMBs, decompressMBs, size};
+        }
+
+        if (baseline.find(CALIBRATION_LABEL) == baseline.end())
+        {
+            throw std::runtime_error("Invalid baseline " + baselinePath + ": no calibration line");
+        }
+    }
+
+    size_t failures = 0;
+
+    std::cout << "Self test" << (baseline.empty() ? "" : " against " + baselinePath) << "\n";
+    std::cout << "----------------------------------------\n";
+    std::cout << std::fixed << std::setprecision(2);
+
+    // a mode of a corpus, with its best speeds so far (MB/s over the best calibration speed)
+    struct Row
+    {
+        std::string label;
+        const std::string *data;
+        const huffmanCompress::CodecMode *mode;
+        size_t compressedSize;
+        char flags;
+        double encodeSpeed, decodeSpeed;
+    };
+
+    // One sample of a row, repeating the round trip for at least SELF_TEST_SAMPLE_SECONDS when timed.
+    // Interference only ever slows a sample down, so the fastest samples are the least noisy.
+    auto sample = [&](Row &row)
+    {
+        bool timed = row.data->size() >= MIN_TIMED_SIZE;
+        codec.sampleStride = row.mode->sampled ? SELF_TEST_SAMPLE_STRIDE : 0;
+        codec.stages = row.mode->stages;
+
+        double encodeSeconds = 0, decodeSeconds = 0;
+        int rounds = 0;
+        do
+        {
+            double encoded, decoded;
+            std::string compressed = codec.roundTrip(*row.data, encoded, decoded);
+            row.compressedSize = compressed.size();
+            row.flags = compressed[0];
+            encodeSeconds += encoded;
+            decodeSeconds += decoded;
+            rounds++;
+        } while (timed && encodeSeconds + decodeSeconds < SELF_TEST_SAMPLE_SECONDS);
+        codec.blockMemory = 0;
+        codec.blockThreads = 0;
+
+        double mb = rounds * row.data->size() / (1024.0 * 1024.0);
+        row.encodeSpeed = std::max(row.encodeSpeed, mb / encodeSeconds);
+        row.decodeSpeed = std::max(row.decodeSpeed, mb / decodeSeconds);
+    };
+
+    // every mode of every corpus is checked with one round trip before anything is timed
+    std::vector<std::pair<std::string, std::string>> corpora = selfTestCorpora();
+    std::vector<Row> rows;
+    for (const auto &corpus : corpora)
+    {
+        try
+        {
+            checkCoders(corpus.second);
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << "FAILED " << corpus.first << ": " << e.what() << "\n";
+            failures++;
+        }
+
+        for (const huffmanCompress::CodecMode &mode : huffmanCompress::CODEC_MODES)
+        {
+            Row row{corpus.first + " " + mode.name, &corpus.second, &mode, 0, 0, 0, 0};
+            try
+            {
+                sample(row);
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "FAILED " << row.label << ": " << e.what() << "\n";
+                failures++;
+                continue;
+            }
+            rows.push_back(row);
+        }
+    }
+
+    // The timed rows are sampled in rounds over all of them, so the samples of every mode are spread
+    // over the whole run and a slow spell of the machine only costs a few of them. The calibration loop
+    // runs before every sample and its best speed scales them all, so a slower machine slows both.
+    double calibration = calibrationSpeed(SELF_TEST_SECONDS);
+    auto measure = [&](const std::vector<Row *> &timedRows)
+    {
+        for (int run = 0; run < SELF_TEST_RUNS; run++)
+        {
+            for (Row *row : timedRows)
+            {
+                calibration = std::max(calibration, calibrationSpeed(CALIBRATION_SECONDS));
+                sample(*row);
+            }
+        }
+    };
+
+    // MB/s are reported at the machine speed the baseline was taken at, or at this one's
+    auto machineSpeed = [&]()
+    {
+        return baseline.empty() ? calibration : std::get<0>(baseline[CALIBRATION_LABEL]);
+    };
+    auto compressMBs = [&](const Row &row) { return row.encodeSpeed / calibration * machineSpeed(); };
+    auto decompressMBs = [&](const Row &row) { return row.decodeSpeed / calibration * machineSpeed(); };
+
+    double floor = 1.0 - threshold;
+    auto slower = [&](const Row &row)
+    {
+        auto reference = baseline.find(row.label);
+        return reference != baseline.end() &&
+               (compressMBs(row) < std::get<0>(reference->second) * floor ||
+                decompressMBs(row) < std::get<1>(reference->second) * floor);
+    };
+
+    std::vector<Row *> timedRows;
+    for (Row &row : rows)
+    {
+        if (row.data->size() >= MIN_TIMED_SIZE)
+            timedRows.push_back(&row);
+    }
+
+    // A mode below the threshold is measured again, and only fails when every measurement was slow.
+    // The speeds kept are the best of all measurements.
+    try
+    {
+        for (int attempt = 0; attempt < CONFIRM_MEASUREMENTS && !timedRows.empty(); attempt++)
+        {
+            measure(timedRows);
+            timedRows.erase(std::remove_if(timedRows.begin(), timedRows.end(), [&](Row *row) { return !slower(*row); }),
+                            timedRows.end());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "FAILED timing: " << e.what() << "\n";
+        failures++;
+    }
+
+    std::ostringstream measured;
+    measured << CALIBRATION_LABEL << " " << calibration << " 0 0\n";
+
+    size_t sampledCorpora = 0;
+    for (const Row &row : rows)
+    {
+        bool timed = row.data->size() >= MIN_TIMED_SIZE;
+        std::cout << std::left << std::setw(20) << row.label << std::right << std::setw(10) << row.compressedSize << " bytes";
+
+        std::string regressions;
+        // a sampled row that fell back to the exact table would time the wrong mode
+        if (row.mode->sampled && !row.mode->stages)
+        {
+            bool expected = row.data->size() >= codec.samplingThreshold(SELF_TEST_SAMPLE_STRIDE);
+            if (((row.flags & huffmanCompress::FLAG_SAMPLED) != 0) != expected)
+                regressions += expected ? ", stream not sampled" : ", sampled below the threshold";
+            sampledCorpora += expected;
+        }
+        if (timed)
+        {
+            std::cout << ", compress " << compressMBs(row) << " MB/s, decompress " << decompressMBs(row) << " MB/s";
+            measured << row.label << " " << compressMBs(row) << " " << decompressMBs(row) << " " << row.compressedSize << "\n";
+
+            auto reference = baseline.find(row.label);
+            if (!baseline.empty() && reference == baseline.end())
+            {
+                regressions += ", not in the baseline";
+            }
+            else if (reference != baseline.end())
+            {
+                if (compressMBs(row) < std::get<0>(reference->second) * floor)
+                    regressions += ", compression below " + std::to_string(std::get<0>(reference->second)) + " MB/s";
+                if (decompressMBs(row) < std::get<1>(reference->second) * floor)
+                    regressions += ", decompression below " + std::to_string(std::get<1>(reference->second)) + " MB/s";
+                // the streams are deterministic, any growth is a ratio regression
+                if (row.compressedSize > std::get<2>(reference->second))
+                    regressions += ", larger than " + std::to_string(std::get<2>(reference->second)) + " bytes";
+            }
+        }
+        std::cout << "\n";
+
+        if (!regressions.empty())
+        {
+            std::cout << "FAILED " << row.label << ": " << regressions.substr(2) << "\n";
+            failures++;
+        }
+    }
+
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << "----------------------------------------\n";
+
+    if (sampledCorpora == 0)
+    {
+        std::cout << "FAILED sampled: no corpus reaches the sampling threshold\n";
+        failures++;
+    }
+
+    if (writeBaseline && failures == 0)
+    {
+        std::ofstream output(baselinePath);
+        output << measured.str();
+        if (!output)
+        {
+            throw std::runtime_error("Failed to write the baseline " + baselinePath);
+        }
+        std::cout << "Baseline written to " << baselinePath << "\n";
+    }
+
+    if (failures)
+    {
+        std::cout << "Self test failed: " << failures << " failures\n";
+        return 1;
+    }
+    std::cout << "Self test passed\n";
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string command = argc > 1 ? argv[1] : "";
+    bool writeBaseline = command == "--write-baseline";
+    if (writeBaseline && argc < 3)
+    {
+        std::cout << "Usage: " << argv[0] << " --write-baseline <baseline>\n";
+        return 1;
+    }
+
+    int first = writeBaseline ? 2 : 1;
+    try
+    {
+        huffmanSelfTest test;
+        return test.run(argc > first ? argv[first] : "", argc > first + 1 ? std::stod(argv[first + 1]) / 100 : huffmanSelfTest::REGRESSION_THRESHOLD,
+                        writeBaseline);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+}
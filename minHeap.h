@@ -2,31 +2,356 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
 
-template <typename T, typename Comparator = std::less<T>>
+// d-ary min heap, 4 children per node keep a whole level of siblings in one or two cache lines.
+// Elements are only moved, so move-only types work.
+template <typename T, typename Comparator = std::less<T>, size_t Arity = 4>
 class minHeap
 {
+    static_assert(Arity >= 2, "a heap needs at least two children per node");
+
 private:
     std::vector<T> data;
     Comparator comp;
 
-    int parent(int index) { return (index - 1) / 2; };
-    int left(int index) { return (index * 2) + 1; };
-    int right(int index) { return (index * 2) + 2; };
+    static size_t parent(size_t index) { return (index - 1) / Arity; };
+    static size_t firstChild(size_t index) { return index * Arity + 1; };
 
 public:
     minHeap(){};
-    minHeap(size_t size) {data.reserve(size);};
-    minHeap(const std::vector<int>& other) {buildHeap(other);};
+    explicit minHeap(size_t size) { data.reserve(size); };
+    template <typename InputIt>
+    minHeap(InputIt first, InputIt last) { buildHeap(first, last); };
 
-    void buildHeap(const std::vector<int>& other);
+    template <typename InputIt>
+    void buildHeap(InputIt first, InputIt last);
     void insert(T val);
+    template <typename... Args>
+    void emplace(Args &&...args);
     T extractMin();
-    void soak(int index);
-    void heapify(int index);
+    const T &top() const;
+    void soak(size_t index);
+    void heapify(size_t index);
+    void reserve(size_t size) { data.reserve(size); };
+    void clear() { data.clear(); };
     void print() const;
-    size_t size() const;
-    bool empty() const;
+    size_t size() const { return data.size(); };
+    bool empty() const { return data.empty(); };
+
+    ~minHeap(){};
+};
+
+// replaces the contents with the range in O(n), pass move iterators to move the elements in
+template <typename T, typename Comparator, size_t Arity>
+template <typename InputIt>
+void minHeap<T, Comparator, Arity>::buildHeap(InputIt first, InputIt last)
+{
+    data.clear();
+    data.insert(data.end(), first, last);
+    if (data.size() < 2)
+        return;
+
+    for (size_t i = parent(data.size() - 1) + 1; i-- > 0;)
+        soak(i);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void minHeap<T, Comparator, Arity>::insert(T el)
+{
+    data.push_back(std::move(el));
+    heapify(data.size() - 1);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+template <typename... Args>
+void minHeap<T, Comparator, Arity>::emplace(Args &&...args)
+{
+    data.emplace_back(std::forward<Args>(args)...);
+    heapify(data.size() - 1);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+T minHeap<T, Comparator, Arity>::extractMin()
+{
+    if (data.empty())
+        throw std::underflow_error("Heap is empty");
+
+    T root = std::move(data.front());
+    if (data.size() > 1)
+    {
+        // the last element nearly always belongs near the bottom: move the hole down along the
+        // smallest children without comparing against it, then sift it up from there
+        T value = std::move(data.back());
+        data.pop_back();
+        size_t n = data.size();
+        size_t index = 0;
+        while (true)
+        {
+            size_t first = firstChild(index);
+            if (first >= n)
+                break;
+
+            size_t last = std::min(first + Arity, n);
+            size_t smallest = first;
+            for (size_t child = first + 1; child < last; child++)
+            {
+                if (comp(data[child], data[smallest]))
+                    smallest = child;
+            }
+            data[index] = std::move(data[smallest]);
+            index = smallest;
+        }
+        data[index] = std::move(value);
+        heapify(index);
+    }
+    else
+    {
+        data.pop_back();
+    }
+
+    return root;
+}
+
+template <typename T, typename Comparator, size_t Arity>
+const T &minHeap<T, Comparator, Arity>::top() const
+{
+    if (data.empty())
+        throw std::underflow_error("Heap is empty");
+
+    return data.front();
+}
+
+// sift up, the element is moved once into its final place
+template <typename T, typename Comparator, size_t Arity>
+void minHeap<T, Comparator, Arity>::heapify(size_t index)
+{
+    T value = std::move(data[index]);
+    while (index != 0 && comp(value, data[parent(index)]))
+    {
+        data[index] = std::move(data[parent(index)]);
+        index = parent(index);
+    }
+    data[index] = std::move(value);
+}
+
+// sift down, iterative with a hole instead of swaps
+template <typename T, typename Comparator, size_t Arity>
+void minHeap<T, Comparator, Arity>::soak(size_t index)
+{
+    size_t n = data.size();
+    T value = std::move(data[index]);
+
+    while (true)
+    {
+        size_t first = firstChild(index);
+        if (first >= n)
+            break;
+
+        size_t last = std::min(first + Arity, n);
+        size_t smallest = first;
+        for (size_t child = first + 1; child < last; child++)
+        {
+            if (comp(data[child], data[smallest]))
+                smallest = child;
+        }
+
+        if (!comp(data[smallest], value))
+            break;
+
+        data[index] = std::move(data[smallest]);
+        index = smallest;
+    }
+    data[index] = std::move(value);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void minHeap<T, Comparator, Arity>::print() const
+{
+    size_t levelEnd = 1;
+    size_t levelSize = 1;
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        if (i == levelEnd)
+        {
+            std::cout << std::endl;
+            levelSize *= Arity;
+            levelEnd += levelSize;
+        }
+        std::cout << data[i] << " ";
+    }
+    std::cout << std::endl;
+}
+
+// d-ary min heap with stable handles, for decrease-key. Handles of extracted elements are reused.
+template <typename T, typename Comparator = std::less<T>, size_t Arity = 4>
+class indexedMinHeap
+{
+    static_assert(Arity >= 2, "a heap needs at least two children per node");
+
+public:
+    using handle = size_t;
+
+private:
+    static constexpr size_t NOT_IN_HEAP = static_cast<size_t>(-1);
+
+    std::vector<handle> heap;    // handles in heap order
+    std::vector<T> values;       // indexed by handle
+    std::vector<size_t> position; // index in heap of every handle
+    std::vector<handle> freeHandles;
+    Comparator comp;
+
+    static size_t parent(size_t index) { return (index - 1) / Arity; };
+    static size_t firstChild(size_t index) { return index * Arity + 1; };
+
+    void place(size_t index, handle h)
+    {
+        heap[index] = h;
+        position[h] = index;
+    };
+    void heapify(size_t index);
+    void soak(size_t index);
+
+public:
+    indexedMinHeap(){};
+    explicit indexedMinHeap(size_t size) { reserve(size); };
+
+    handle insert(T val);
+    T extractMin();
+    const T &top() const;
+    const T &get(handle h) const { return values[h]; };
+    bool contains(handle h) const { return h < position.size() && position[h] != NOT_IN_HEAP; };
+    void decreaseKey(handle h, T val);
+    void reserve(size_t size);
+    void clear();
+    size_t size() const { return heap.size(); };
+    bool empty() const { return heap.empty(); };
+
+    ~indexedMinHeap(){};
+};
+
+template <typename T, typename Comparator, size_t Arity>
+typename indexedMinHeap<T, Comparator, Arity>::handle indexedMinHeap<T, Comparator, Arity>::insert(T val)
+{
+    handle h;
+    if (!freeHandles.empty())
+    {
+        h = freeHandles.back();
+        freeHandles.pop_back();
+        values[h] = std::move(val);
+    }
+    else
+    {
+        h = values.size();
+        values.push_back(std::move(val));
+        position.push_back(NOT_IN_HEAP);
+    }
+
+    heap.push_back(h);
+    position[h] = heap.size() - 1;
+    heapify(heap.size() - 1);
+    return h;
+}
+
+template <typename T, typename Comparator, size_t Arity>
+T indexedMinHeap<T, Comparator, Arity>::extractMin()
+{
+    if (heap.empty())
+        throw std::underflow_error("Heap is empty");
+
+    handle h = heap.front();
+    position[h] = NOT_IN_HEAP;
+    freeHandles.push_back(h);
+
+    handle last = heap.back();
+    heap.pop_back();
+    if (!heap.empty())
+    {
+        place(0, last);
+        soak(0);
+    }
+
+    return std::move(values[h]);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+const T &indexedMinHeap<T, Comparator, Arity>::top() const
+{
+    if (heap.empty())
+        throw std::underflow_error("Heap is empty");
+
+    return values[heap.front()];
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void indexedMinHeap<T, Comparator, Arity>::decreaseKey(handle h, T val)
+{
+    if (!contains(h))
+        throw std::out_of_range("Handle is not in the heap");
+    if (comp(values[h], val))
+        throw std::invalid_argument("decreaseKey would increase the key");
+
+    values[h] = std::move(val);
+    heapify(position[h]);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void indexedMinHeap<T, Comparator, Arity>::reserve(size_t size)
+{
+    heap.reserve(size);
+    values.reserve(size);
+    position.reserve(size);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void indexedMinHeap<T, Comparator, Arity>::clear()
+{
+    heap.clear();
+    values.clear();
+    position.clear();
+    freeHandles.clear();
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void indexedMinHeap<T, Comparator, Arity>::heapify(size_t index)
+{
+    handle h = heap[index];
+    while (index != 0 && comp(values[h], values[heap[parent(index)]]))
+    {
+        place(index, heap[parent(index)]);
+        index = parent(index);
+    }
+    place(index, h);
+}
+
+template <typename T, typename Comparator, size_t Arity>
+void indexedMinHeap<T, Comparator, Arity>::soak(size_t index)
+{
+    size_t n = heap.size();
+    handle h = heap[index];
+
+    while (true)
+    {
+        size_t first = firstChild(index);
+        if (first >= n)
+            break;
+
+        size_t last = std::min(first + Arity, n);
+        size_t smallest = first;
+        for (size_t child = first + 1; child < last; child++)
+        {
+            if (comp(values[heap[child]], values[heap[smallest]]))
+                smallest = child;
+        }
+
+        if (!comp(values[heap[smallest]], values[h]))
+            break;
 
-    ~minHeap() {};
-};
\ No newline at end of file
+        place(index, heap[smallest]);
+        index = smallest;
+    }
+    place(index, h);
+}
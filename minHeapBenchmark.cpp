@@ -0,0 +1,219 @@
+#include "minHeap.h"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <queue>
+#include <random>
+
+// Microbenchmarks of minHeap and indexedMinHeap against std::priority_queue.
+// Every run checks that the elements come out sorted.
+
+struct CompareUnique
+{
+    bool operator()(const std::unique_ptr<int> &lhs, const std::unique_ptr<int> &rhs) const
+    {
+        return *lhs < *rhs;
+    }
+};
+
+template <typename F>
+double timeMs(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void check(bool sorted, const std::string &name)
+{
+    if (!sorted)
+        throw std::runtime_error(name + " returned the elements out of order!");
+}
+
+void report(const std::string &name, double ms, double baselineMs)
+{
+    std::cout << std::left << std::setw(36) << name << std::right << std::setw(10) << ms << " ms";
+    if (baselineMs > 0)
+        std::cout << "  (" << baselineMs / ms << "x std::priority_queue)";
+    std::cout << "\n";
+}
+
+template <typename Heap>
+double pushPop(const std::vector<int> &values, const std::string &name)
+{
+    Heap heap;
+    bool sorted = true;
+    double ms = timeMs([&]
+                       {
+        for (int v : values)
+            heap.insert(v);
+        int last = heap.extractMin();
+        while (!heap.empty())
+        {
+            int current = heap.extractMin();
+            sorted &= last <= current;
+            last = current;
+        } });
+    check(sorted, name);
+    return ms;
+}
+
+double pushPopStd(const std::vector<int> &values)
+{
+    std::priority_queue<int, std::vector<int>, std::greater<int>> heap;
+    bool sorted = true;
+    double ms = timeMs([&]
+                       {
+        for (int v : values)
+            heap.push(v);
+        int last = heap.top();
+        heap.pop();
+        while (!heap.empty())
+        {
+            sorted &= last <= heap.top();
+            last = heap.top();
+            heap.pop();
+        } });
+    check(sorted, "std::priority_queue");
+    return ms;
+}
+
+void benchmarkPushPop(const std::vector<int> &values)
+{
+    double baseline = pushPopStd(values);
+    report("push/pop std::priority_queue", baseline, 0);
+    report("push/pop minHeap<2>", pushPop<minHeap<int, std::less<int>, 2>>(values, "minHeap<2>"), baseline);
+    report("push/pop minHeap<4>", pushPop<minHeap<int>>(values, "minHeap<4>"), baseline);
+    report("push/pop minHeap<8>", pushPop<minHeap<int, std::less<int>, 8>>(values, "minHeap<8>"), baseline);
+}
+
+void benchmarkBuild(const std::vector<int> &values)
+{
+    std::priority_queue<int, std::vector<int>, std::greater<int>> reference;
+    double baseline = timeMs([&]
+                             { reference = std::priority_queue<int, std::vector<int>, std::greater<int>>(values.begin(), values.end()); });
+    check(reference.top() == *std::min_element(values.begin(), values.end()), "std::priority_queue");
+
+    minHeap<int> heap;
+    double ms = timeMs([&]
+                       { heap.buildHeap(values.begin(), values.end()); });
+    check(heap.top() == reference.top(), "minHeap::buildHeap");
+
+    report("bulk build std::priority_queue", baseline, 0);
+    report("bulk build minHeap<4>", ms, baseline);
+}
+
+// std::priority_queue::top is const, so move-only elements can't be popped without a copy
+void benchmarkMoveOnly(const std::vector<int> &values)
+{
+    std::vector<std::unique_ptr<int>> pointers;
+    for (int v : values)
+        pointers.push_back(std::make_unique<int>(v));
+
+    minHeap<std::unique_ptr<int>, CompareUnique> heap;
+    heap.reserve(pointers.size());
+    bool sorted = true;
+    double ms = timeMs([&]
+                       {
+        heap.buildHeap(std::make_move_iterator(pointers.begin()), std::make_move_iterator(pointers.end()));
+        int last = *heap.extractMin();
+        while (!heap.empty())
+        {
+            std::unique_ptr<int> current = heap.extractMin();
+            sorted &= last <= *current;
+            last = *current;
+        } });
+    check(sorted, "minHeap<unique_ptr>");
+
+    report("build/pop minHeap<unique_ptr>", ms, 0);
+}
+
+// Dijkstra like workload: every key is lowered a few times before it is extracted.
+// std::priority_queue has no decrease-key, it pushes duplicates and skips stale ones.
+void benchmarkDecreaseKey(const std::vector<int> &values)
+{
+    const int updates = 4;
+    std::mt19937 rng(7);
+
+    std::vector<std::pair<size_t, int>> lowered;
+    std::vector<int> keys = values;
+    for (int round = 0; round < updates; round++)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            keys[i] -= rng() % 1000;
+            lowered.push_back({i, keys[i]});
+        }
+    }
+
+    std::priority_queue<std::pair<int, size_t>, std::vector<std::pair<int, size_t>>, std::greater<std::pair<int, size_t>>> reference;
+    std::vector<int> best = values;
+    bool sorted = true;
+    double baseline = timeMs([&]
+                             {
+        for (size_t i = 0; i < values.size(); i++)
+            reference.push({values[i], i});
+        for (const auto &update : lowered)
+        {
+            best[update.first] = update.second;
+            reference.push({update.second, update.first});
+        }
+        int last = INT32_MIN;
+        while (!reference.empty())
+        {
+            auto current = reference.top();
+            reference.pop();
+            if (current.first != best[current.second])
+                continue;
+            sorted &= last <= current.first;
+            last = current.first;
+        } });
+    check(sorted, "std::priority_queue");
+
+    indexedMinHeap<int> heap;
+    heap.reserve(values.size());
+    std::vector<indexedMinHeap<int>::handle> handles;
+    sorted = true;
+    double ms = timeMs([&]
+                       {
+        for (int v : values)
+            handles.push_back(heap.insert(v));
+        for (const auto &update : lowered)
+            heap.decreaseKey(handles[update.first], update.second);
+        int last = INT32_MIN;
+        while (!heap.empty())
+        {
+            int current = heap.extractMin();
+            sorted &= last <= current;
+            last = current;
+        } });
+    check(sorted, "indexedMinHeap");
+
+    report("decrease-key std::priority_queue", baseline, 0);
+    report("decrease-key indexedMinHeap<4>", ms, baseline);
+}
+
+int main()
+{
+    std::cout << std::fixed << std::setprecision(2);
+
+    for (size_t n : {1000, 100000, 1000000})
+    {
+        std::mt19937 rng(42);
+        std::vector<int> values(n);
+        for (int &v : values)
+            v = rng() % 1000000000;
+
+        std::cout << "n = " << n << "\n";
+        std::cout << "----------------------------------------\n";
+        benchmarkPushPop(values);
+        benchmarkBuild(values);
+        benchmarkMoveOnly(values);
+        benchmarkDecreaseKey(values);
+        std::cout << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+
+// bytes held by the containers of the suffix sorter on the current thread, for reporting the
+// memory a block needs
+struct suffixArrayMemory
+{
+    static inline thread_local size_t current = 0;
+    static inline thread_local size_t peak = 0;
+
+    static void reset() { peak = current; };
+};
+
+template <typename T>
+struct trackedAllocator
+{
+    using value_type = T;
+
+    trackedAllocator(){};
+    template <typename U>
+    trackedAllocator(const trackedAllocator<U> &){};
+
+    T *allocate(size_t n)
+    {
+        T *p = std::allocator<T>().allocate(n);
+        suffixArrayMemory::current += n * sizeof(T);
+        suffixArrayMemory::peak = std::max(suffixArrayMemory::peak, suffixArrayMemory::current);
+        return p;
+    };
+    void deallocate(T *p, size_t n)
+    {
+        suffixArrayMemory::current -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    };
+
+    template <typename U>
+    bool operator==(const trackedAllocator<U> &) const { return true; };
+    template <typename U>
+    bool operator!=(const trackedAllocator<U> &) const { return false; };
+};
+
+using suffixArrayInts = std::vector<int32_t, trackedAllocator<int32_t>>;
+
+// SA-IS (Nong, Zhang and Chan), linear time. s holds values in [0, upper], a suffix that is a
+// prefix of another one sorts first, as if the text ended with a unique smallest sentinel.
+inline suffixArrayInts sais(const suffixArrayInts &s, int32_t upper)
+{
+    int32_t n = s.size();
+    if (n == 0)
+        return {};
+    if (n == 1)
+        return suffixArrayInts{0};
+    if (n == 2)
+        return s[0] < s[1] ? suffixArrayInts{0, 1} : suffixArrayInts{1, 0};
+
+    suffixArrayInts sa(n);
+
+    // S type suffixes are smaller than the suffix after them, L type ones larger
+    std::vector<char, trackedAllocator<char>> ls(n, 0);
+    for (int32_t i = n - 2; i >= 0; i--)
+        ls[i] = (s[i] == s[i + 1]) ? ls[i + 1] : (s[i] < s[i + 1]);
+
+    // bucket starts of the L and S suffixes of every symbol
+    suffixArrayInts sumL(upper + 1, 0), sumS(upper + 1, 0);
+    for (int32_t i = 0; i < n; i++)
+    {
+        if (!ls[i])
+            sumS[s[i]]++;
+        else
+            sumL[s[i] + 1]++;
+    }
+    for (int32_t i = 0; i <= upper; i++)
+    {
+        sumS[i] += sumL[i];
+        if (i < upper)
+            sumL[i + 1] += sumS[i];
+    }
+
+    // places the LMS suffixes and sorts the others from them
+    auto induce = [&](const suffixArrayInts &lms)
+    {
+        std::fill(sa.begin(), sa.end(), -1);
+        suffixArrayInts buf(upper + 1);
+        std::copy(sumS.begin(), sumS.end(), buf.begin());
+        for (int32_t d : lms)
+        {
+            if (d == n)
+                continue;
+            sa[buf[s[d]]++] = d;
+        }
+
+        std::copy(sumL.begin(), sumL.end(), buf.begin());
+        sa[buf[s[n - 1]]++] = n - 1;
+        for (int32_t i = 0; i < n; i++)
+        {
+            int32_t v = sa[i];
+            if (v >= 1 && !ls[v - 1])
+                sa[buf[s[v - 1]]++] = v - 1;
+        }
+
+        std::copy(sumL.begin(), sumL.end(), buf.begin());
+        for (int32_t i = n - 1; i >= 0; i--)
+        {
+            int32_t v = sa[i];
+            if (v >= 1 && ls[v - 1])
+                sa[--buf[s[v - 1] + 1]] = v - 1;
+        }
+    };
+
+    suffixArrayInts lmsMap(n + 1, -1);
+    int32_t m = 0;
+    for (int32_t i = 1; i < n; i++)
+    {
+        if (!ls[i - 1] && ls[i])
+            lmsMap[i] = m++;
+    }
+    suffixArrayInts lms;
+    lms.reserve(m);
+    for (int32_t i = 1; i < n; i++)
+    {
+        if (!ls[i - 1] && ls[i])
+            lms.push_back(i);
+    }
+
+    induce(lms);
+
+    if (m)
+    {
+        suffixArrayInts sortedLms;
+        sortedLms.reserve(m);
+        for (int32_t v : sa)
+        {
+            if (lmsMap[v] != -1)
+                sortedLms.push_back(v);
+        }
+
+        // names of the LMS substrings, equal substrings get the same name
+        suffixArrayInts recS(m);
+        int32_t recUpper = 0;
+        recS[lmsMap[sortedLms[0]]] = 0;
+        for (int32_t i = 1; i < m; i++)
+        {
+            int32_t l = sortedLms[i - 1], r = sortedLms[i];
+            int32_t endL = (lmsMap[l] + 1 < m) ? lms[lmsMap[l] + 1] : n;
+            int32_t endR = (lmsMap[r] + 1 < m) ? lms[lmsMap[r] + 1] : n;
+            bool same = true;
+            if (endL - l != endR - r)
+            {
+                same = false;
+            }
+            else
+            {
+                while (l < endL && s[l] == s[r])
+                {
+                    l++;
+                    r++;
+                }
+                if (l == n || s[l] != s[r])
+                    same = false;
+            }
+            if (!same)
+                recUpper++;
+            recS[lmsMap[sortedLms[i]]] = recUpper;
+        }
+
+        // the names are unique or the order of the LMS suffixes is found recursively
+        suffixArrayInts recSa = sais(recS, recUpper);
+        for (int32_t i = 0; i < m; i++)
+            sortedLms[i] = lms[recSa[i]];
+        induce(sortedLms);
+    }
+
+    return sa;
+}
+
+// suffix array of n < 2^31 bytes
+inline suffixArrayInts suffixArray(const unsigned char *text, size_t n)
+{
+    suffixArrayInts s(text, text + n);
+    return sais(s, 255);
+}